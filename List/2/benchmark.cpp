@@ -0,0 +1,78 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+
+#include "consistent_linked_list.h"
+#include "workload_driver.h"
+
+const int N_ELEMENTS = 1e6;
+const int N_ROUNDS = 5;
+
+// best of N_ROUNDS, nanoseconds per element
+template<typename F>
+double measure(F loop) {
+    double best = 0;
+    for (int i = 0; i < N_ROUNDS; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        loop();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        double per_element = elapsed.count() / N_ELEMENTS;
+        best = i == 0 ? per_element : std::min(best, per_element);
+    }
+    return best;
+}
+
+int main() {
+    consistent_linked_list<int> list;
+    for (int i = 0; i < N_ELEMENTS; ++i) {
+        list.push_back(i);
+    }
+
+    long long sum = 0;
+    std::cout << "--benchmark.cpp: iteration over " << N_ELEMENTS << " elements, ns/element--\n";
+
+    double prefix = measure([&] {
+        for (auto it = list.begin(); it != list.end(); ++it) {
+            sum += *it;
+        }
+    });
+    std::cout << std::setw(32) << std::left << "++it, it != list.end()" << prefix << "\n";
+
+    double postfix = measure([&] {
+        for (auto it = list.begin(); it != list.end(); it++) {
+            sum += *it;
+        }
+    });
+    std::cout << std::setw(32) << "it++, it != list.end()" << postfix << "\n";
+
+    double cached_end = measure([&] {
+        auto end = list.end();
+        for (auto it = list.begin(); it != end; ++it) {
+            sum += *it;
+        }
+    });
+    std::cout << std::setw(32) << "++it, cached end" << cached_end << "\n";
+
+    // the same loops while other threads keep the list busy at its front
+    workload_driver driver(4);
+    double contended = 0;
+    driver.run([&](size_t i) {
+        if (i == 0) {
+            contended = measure([&] {
+                for (auto it = list.begin(); it != list.end(); ++it) {
+                    sum += *it;
+                }
+            });
+        } else {
+            for (int j = 0; j < N_ELEMENTS / 10; ++j) {
+                list.push_front(-j);
+                list.pop_first();
+            }
+        }
+    });
+    std::cout << std::setw(32) << "++it with 3 writers" << contended << "\n";
+
+    // keeps the loops from being optimized out
+    return sum == 0 ? 1 : 0;
+}
@@ -5,6 +5,18 @@
 #include <exception>
 #include <mutex>
 #include <thread>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <optional>
+
+#include "thread_pool.h"
+#include "container_stats.h"
+#include "lock_profiler.h"
+#include "container_metrics.h"
 
 class consistent_linked_list_exception : std::exception {
 public:
@@ -22,50 +34,173 @@ public:
 template<typename T>
 class consistent_linked_list {
 private:
+    /*
+     * ref_count keeps iterator pins in its low half and LINK references in its
+     * high half: one while the node is in the list and one from every erased
+     * node whose prev or next points to it. Erased nodes keep their links, so
+     * an iterator on one can still move, and the node is freed when the count
+     * drops to zero.
+     */
     class Node {
     public:
-        Node(consistent_linked_list<T> *base_list_, const T &t) :
-                base_list(base_list_), value(t) {}
+        static constexpr uint64_t PIN = 1;
+        static constexpr uint64_t LINK = uint64_t(1) << 32;
+        static constexpr uint64_t PIN_MASK = LINK - 1;
+
+        template<typename... Args>
+        explicit Node(consistent_linked_list<T> *base_list_, Args &&... args) :
+                base_list(base_list_), value(std::forward<Args>(args)...) {}
 
         consistent_linked_list<T> *base_list;
         T value;
-        Node *prev = nullptr;
-        Node *next = nullptr;
+        // changed under m, read without it by iterators
+        std::atomic<Node *> prev{nullptr};
+        std::atomic<Node *> next{nullptr};
+
+        std::atomic<bool> is_deleted{false};
+        std::atomic<uint64_t> ref_count{0};
+
+        void add_ref_count(uint64_t value_) {
+            if (this == base_list->END_NODE) {
+                return;
+            }
+            ref_count.fetch_add(value_);
+        }
+
+        void release(uint64_t value_) {
+            if (this == base_list->END_NODE) {
+                return;
+            }
+            if (ref_count.fetch_sub(value_) == value_) {
+                base_list->free_node(this);
+            }
+        }
 
-        bool is_deleted = false;
-        int ref_count = 0;
+        // fails if the node is already unreachable and about to be freed;
+        // pins_before doesn't count END_NODE as unpinned, it isn't in the metrics
+        bool try_pin(uint64_t &pins_before) {
+            if (this == base_list->END_NODE) {
+                pins_before = 1;
+                return true;
+            }
+            uint64_t before = ref_count.load();
+            do {
+                if (before == 0) {
+                    return false;
+                }
+            } while (!ref_count.compare_exchange_weak(before, before + PIN));
+            pins_before = before & PIN_MASK;
+            return true;
+        }
+
+        // the pins left, the node may be freed when it returns 0
+        uint64_t drop_pin() {
+            if (this == base_list->END_NODE) {
+                return 1;
+            }
+            uint64_t after = ref_count.fetch_sub(PIN) - PIN;
+            uint64_t pins_after = after & PIN_MASK;
+            if (after == 0) {
+                base_list->free_node(this);
+            }
+            return pins_after;
+        }
 
-        void add_ref_count(const int &value_) {
+        void pin() {
             if (this == base_list->END_NODE) {
                 return;
             }
+            uint64_t before = ref_count.fetch_add(PIN);
+            base_list->metrics_.on_pin((int64_t) (before & PIN_MASK), 1);
+        }
 
-            ref_count += value_;
-            if (ref_count <= 0) {
-                base_list->n_deleted_node++;
-//                cout << "It's all, we deleted :( value = " << value << endl;
-                delete this;
+        void unpin() {
+            // drop_pin() may free the node
+            consistent_linked_list<T> *list = base_list;
+            if (drop_pin() == 0) {
+                live_metrics::add(list->metrics_.pinned_nodes, -1);
             }
         }
     };
 
-    std::recursive_mutex m;
+#ifdef CONSISTENT_STATS
+    stats_recorder stats_;
+#endif
+#ifdef CONSISTENT_LOCK_PROFILING
+    lock_profile lock_profile_;
+#endif
+#if defined(CONSISTENT_LOCK_PROFILING) && defined(CONSISTENT_STATS)
+    using mutex_t = profiled_mutex<stats_mutex<std::recursive_mutex>>;
+    mutex_t m{&lock_profile_, &stats_};
+#elif defined(CONSISTENT_LOCK_PROFILING)
+    using mutex_t = profiled_mutex<std::recursive_mutex>;
+    mutex_t m{&lock_profile_};
+#elif defined(CONSISTENT_STATS)
+    using mutex_t = stats_mutex<std::recursive_mutex>;
+    mutex_t m{&stats_};
+#else
+    using mutex_t = std::recursive_mutex;
+    mutex_t m;
+#endif
+
+    live_metrics metrics_;
+
+    // iterators moving without m; while there are any, freed nodes wait in retired
+    std::atomic<size_t> readers{0};
+    std::vector<Node *> retired;
+    std::atomic<bool> has_retired{false};
+    // set while a writer past RETIRED_LIMIT waits for the readers to leave; new step()s wait on m
+    std::atomic<bool> draining{false};
 
     Node *END_NODE;
 
     Node *first;
     Node *last;
 
-    size_t list_size = 0;
+    // only changed under m, size() and empty() read it without locking
+    std::atomic<size_t> list_size{0};
 
-    Node *create_new_node(const T &value) {
-        return new Node(this, value);
+    template<typename... Args>
+    Node *create_new_node(Args &&... args) {
+        return new Node(this, std::forward<Args>(args)...);
+    }
+
+    static constexpr size_t MIN_PARALLEL_TASK_SIZE = 1 << 12;
+
+    // first nodes of consecutive runs of the list, a few runs per worker; the
+    // last run ends at END_NODE. The caller holds m.
+    std::vector<Node *> split(thread_pool &pool) {
+        size_t run_size = std::max(list_size.load() / (4 * pool.size()), MIN_PARALLEL_TASK_SIZE);
+        std::vector<Node *> starts;
+        size_t i = 0;
+        for (Node *node = first; node != END_NODE; node = node->next, ++i) {
+            if (i % run_size == 0) {
+                starts.push_back(node);
+            }
+        }
+        return starts;
+    }
+
+    // calls fn(i, from, to) for the run [starts[i], starts[i + 1]) on the pool
+    // and waits for all of them
+    template<typename F>
+    void run_parallel(thread_pool &pool, const std::vector<Node *> &starts, F fn) {
+        std::vector<std::future<void>> tasks;
+        tasks.reserve(starts.size());
+        for (size_t i = 0; i < starts.size(); ++i) {
+            Node *to = i + 1 < starts.size() ? starts[i + 1] : END_NODE;
+            tasks.push_back(pool.submit([&fn, &starts, i, to] { fn(i, starts[i], to); }));
+        }
+        for (auto &task: tasks) {
+            pool.wait(task);
+        }
     }
 
     void remove_node(Node *node) {
         if (node->is_deleted) return;
 
-        node->is_deleted = 1;
+        node->is_deleted = true;
+        live_metrics::add(metrics_.tombstones, 1);
 
         Node *prev = node->prev;
         Node *next = node->next;
@@ -73,7 +208,9 @@ private:
         prev->next = next;
         next->prev = prev;
 
-        node->add_ref_count(-2);
+        // node still points to them
+        prev->add_ref_count(Node::LINK);
+        next->add_ref_count(Node::LINK);
 
         if (first == last) {
             first = last = END_NODE;
@@ -83,17 +220,120 @@ private:
             last = prev;
         }
 
-
         list_size--;
+        node->release(Node::LINK);
+    }
+
+    /*
+     * node has no references left, so nothing reaches it any more. Its links
+     * are released, which may free its neighbours too, and it's deleted once
+     * no iterator is moving without the lock.
+     */
+    void free_node(Node *node) {
+        std::lock_guard lock(m);
+        size_t i = retired.size();
+        retired.push_back(node);
+        for (; i < retired.size(); ++i) {
+            Node *freed = retired[i];
+            for (Node *neighbour: {freed->prev.load(), freed->next.load()}) {
+                if (neighbour != END_NODE && neighbour->ref_count.fetch_sub(Node::LINK) == Node::LINK) {
+                    retired.push_back(neighbour);
+                }
+            }
+            n_deleted_node++;
+            live_metrics::add(metrics_.tombstones, -1);
+            live_metrics::add(metrics_.frees, 1);
+        }
+        has_retired = true;
+        if (retired.size() >= RETIRED_LIMIT) {
+            drain();
+        } else {
+            reclaim();
+        }
+    }
+
+    // first node equal to value, END_NODE if there is none; the caller holds m
+    Node *find_node(const T &value) {
+        Node *node = first;
+        while (node != END_NODE && !(node->value == value)) {
+            node = node->next;
+        }
+        return node;
+    }
+
+    // deletes the retired nodes if no iterator can be reading them; the caller holds m
+    void reclaim() {
+        if (readers.load() != 0) {
+            return;
+        }
+        for (Node *node: retired) {
+            delete node;
+        }
+        retired.clear();
+        has_retired = false;
+    }
+
+    // reclaim() that doesn't give up while there are readers; the caller holds m
+    void drain() {
+        draining = true;
+        while (readers.load() != 0) {
+            std::this_thread::yield();
+        }
+        reclaim();
+        draining = false;
+    }
+
+    /*
+     * Pins and returns the first live node after from (before it if !forward)
+     * without locking m. With release_from the pin of from moves to it, and
+     * the caller must not use from any more.
+     */
+    Node *step(Node *from, bool forward, bool release_from) {
+        readers.fetch_add(1);
+        while (draining.load()) {
+            readers.fetch_sub(1);
+            {
+                std::lock_guard wait(m);
+            }
+            readers.fetch_add(1);
+        }
+        Node *res;
+        uint64_t pins_before;
+        do {
+            res = forward ? from->next.load() : from->prev.load();
+            while (res != END_NODE && res->is_deleted.load()) {
+                res = forward ? res->next.load() : res->prev.load();
+            }
+        } while (!res->try_pin(pins_before));
+
+        if (readers.fetch_sub(1) == 1 && has_retired.load() && m.try_lock()) {
+            reclaim();
+            m.unlock();
+        }
+
+        // moving the only pin from node to node leaves pinned_nodes as it is
+        int64_t pinned = pins_before == 0 ? 1 : 0;
+        if (release_from && from->drop_pin() == 0) {
+            pinned--;
+        }
+        if (pinned != 0) {
+            live_metrics::add(metrics_.pinned_nodes, pinned);
+        }
+        return res;
     }
 
 public:
+    // retired nodes past which a writer frees them even if iterators keep moving
+    static constexpr size_t RETIRED_LIMIT = 256;
+
     size_t n_deleted_node = 0;
 
     class consistent_iterator;
 
+    class value_guard;
+
     consistent_linked_list() {
-        END_NODE = new Node(this, 0);
+        END_NODE = new Node(this);
         END_NODE->next = END_NODE;
         END_NODE->prev = END_NODE;
         first = last = END_NODE;
@@ -106,14 +346,28 @@ public:
     }
 
     ~consistent_linked_list() {
-        for (auto it = begin(); it != end(); it++) {
+        for (auto it = begin(); it != end(); ++it) {
             erase(it);
         }
+        m.lock();
+        reclaim();
+        m.unlock();
         delete END_NODE;
     }
 
     void push_front(const T &value) {
-        Node *new_node = create_new_node(value);
+        emplace_front(value);
+    }
+
+    void push_front(T &&value) {
+        emplace_front(std::move(value));
+    }
+
+    template<typename... Args>
+    void emplace_front(Args &&... args) {
+        CONSISTENT_LOCK_SITE("push_front");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::INSERT);
+        Node *new_node = create_new_node(std::forward<Args>(args)...);
 
         m.lock();
         new_node->prev = END_NODE;
@@ -122,7 +376,7 @@ public:
         new_node->next = first;
         first->prev = new_node;
 
-        new_node->add_ref_count(2);
+        new_node->add_ref_count(Node::LINK);
 
         first = new_node;
         if (last == END_NODE) {
@@ -134,7 +388,18 @@ public:
     }
 
     void push_back(const T &value) {
-        Node *new_node = create_new_node(value);
+        emplace_back(value);
+    }
+
+    void push_back(T &&value) {
+        emplace_back(std::move(value));
+    }
+
+    template<typename... Args>
+    void emplace_back(Args &&... args) {
+        CONSISTENT_LOCK_SITE("push_back");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::INSERT);
+        Node *new_node = create_new_node(std::forward<Args>(args)...);
 
         m.lock();
         new_node->prev = last;
@@ -143,7 +408,7 @@ public:
         new_node->next = END_NODE;
         END_NODE->prev = new_node;
 
-        new_node->add_ref_count(2);
+        new_node->add_ref_count(Node::LINK);
 
         last = new_node;
         if (first == END_NODE) {
@@ -155,18 +420,23 @@ public:
     }
 
     void pop_first() {
+        CONSISTENT_LOCK_SITE("pop_first");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::ERASE);
         m.lock();
         remove_node(first);
         m.unlock();
     }
 
     void pop_last() {
+        CONSISTENT_LOCK_SITE("pop_last");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::ERASE);
         m.lock();
         remove_node(last);
         m.unlock();
     }
 
     T front() {
+        CONSISTENT_LOCK_SITE("front");
         m.lock();
         if (list_size == 0) {
             m.unlock();
@@ -178,6 +448,7 @@ public:
     }
 
     T back() {
+        CONSISTENT_LOCK_SITE("back");
         m.lock();
         if (list_size == 0) {
             m.unlock();
@@ -188,35 +459,81 @@ public:
         return res;
     }
 
-    consistent_iterator begin() {
+    // front() and back() without copying
+    value_guard front_guard() {
+        CONSISTENT_LOCK_SITE("front");
         m.lock();
-        auto res = consistent_iterator(first);
+        if (list_size == 0) {
+            m.unlock();
+            throw consistent_linked_list_exception("List size is 0.");
+        }
+        value_guard res(first);
         m.unlock();
         return res;
     }
 
-    consistent_iterator end() {
+    value_guard back_guard() {
+        CONSISTENT_LOCK_SITE("back");
         m.lock();
-        auto res = consistent_iterator(END_NODE);
+        if (list_size == 0) {
+            m.unlock();
+            throw consistent_linked_list_exception("List size is 0.");
+        }
+        value_guard res(last);
         m.unlock();
         return res;
     }
 
+    // END_NODE->next is the first node, so begin() moves like an iterator does
+    consistent_iterator begin() {
+        return consistent_iterator(step(END_NODE, true, false), typename consistent_iterator::adopt_pin());
+    }
+
+    // END_NODE is never freed or pinned
+    consistent_iterator end() {
+        return consistent_iterator(END_NODE);
+    }
+
+    // latency histograms, empty unless built with CONSISTENT_STATS
+    container_stats stats() {
+#ifdef CONSISTENT_STATS
+        return stats_.snapshot();
+#else
+        return container_stats();
+#endif
+    }
+
+    // tombstones, pinned nodes and frees, readable at any time without locking
+    container_metrics metrics() const {
+        return metrics_.snapshot();
+    }
+
+    // lock contention per call site, empty unless built with CONSISTENT_LOCK_PROFILING
+    lock_stats_snapshot lock_stats() {
+#ifdef CONSISTENT_LOCK_PROFILING
+        return lock_profile_.snapshot();
+#else
+        return lock_stats_snapshot();
+#endif
+    }
+
     bool empty() {
-        m.lock();
-        int res = list_size;
-        m.unlock();
-        return res == 0;
+        return list_size.load(std::memory_order_relaxed) == 0;
     }
 
     size_t size() {
-        m.lock();
-        int res = list_size;
-        m.unlock();
-        return res;
+        return list_size.load(std::memory_order_relaxed);
+    }
+
+    // freed nodes waiting for iterators to move on, at most RETIRED_LIMIT
+    size_t n_retired() {
+        std::lock_guard lock(m);
+        return retired.size();
     }
 
     void erase(consistent_iterator t) {
+        CONSISTENT_LOCK_SITE("erase");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::ERASE);
         m.lock();
         Node *node = t.get_node();
         if (node == END_NODE) {
@@ -228,22 +545,26 @@ public:
     }
 
     void erase(const T &value) {
+        CONSISTENT_LOCK_SITE("erase");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::ERASE);
         m.lock();
         consistent_iterator it = begin();
-        for (; it != end(); it++) {
+        for (; it != end(); ++it) {
             if (*it == value) {
                 break;
             }
         }
         if (it != end()) {
-            erase(it);
+            remove_node(it.get_node());
         }
         m.unlock();
     }
 
     consistent_iterator find(const T &value) {
+        CONSISTENT_LOCK_SITE("find");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::FIND);
         m.lock();
-        for (consistent_iterator it = begin(); it != end(); it++) {
+        for (consistent_iterator it = begin(); it != end(); ++it) {
             if (*it == value) {
                 auto res = it;
                 m.unlock();
@@ -256,21 +577,56 @@ public:
     }
 
     bool contain(const T &value) {
-        m.lock();
-        consistent_iterator it = begin();
-        consistent_iterator end_it = end();
-        while (it != end_it) {
-            if (value == *it) {
-                m.unlock();
-                return true;
+        return contains(value);
+    }
+
+    /*
+     * Read-only queries. They walk the live nodes under m without iterators,
+     * so nothing is pinned and no reference count is written.
+     */
+    bool contains(const T &value) {
+        CONSISTENT_LOCK_SITE("find");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::FIND);
+        std::lock_guard lock(m);
+        return find_node(value) != END_NODE;
+    }
+
+    size_t count(const T &value) {
+        CONSISTENT_LOCK_SITE("find");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::FIND);
+        std::lock_guard lock(m);
+        size_t res = 0;
+        for (Node *node = first; node != END_NODE; node = node->next) {
+            res += node->value == value;
+        }
+        return res;
+    }
+
+    // a copy of the first element equal to value
+    std::optional<T> try_get(const T &value) {
+        CONSISTENT_LOCK_SITE("find");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::FIND);
+        std::lock_guard lock(m);
+        Node *node = find_node(value);
+        return node == END_NODE ? std::nullopt : std::optional<T>(node->value);
+    }
+
+    // the smallest element not less than value; the list isn't sorted, so it looks at all of them
+    std::optional<T> lower_bound_value(const T &value) {
+        CONSISTENT_LOCK_SITE("find");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::FIND);
+        std::lock_guard lock(m);
+        Node *res = END_NODE;
+        for (Node *node = first; node != END_NODE; node = node->next) {
+            if (!(node->value < value) && (res == END_NODE || node->value < res->value)) {
+                res = node;
             }
-            it++;
         }
-        m.unlock();
-        return false;
+        return res == END_NODE ? std::nullopt : std::optional<T>(res->value);
     }
 
     void shrink_to_fit() {
+        CONSISTENT_LOCK_SITE("shrink_to_fit");
         m.lock();
         consistent_linked_list list;
         consistent_iterator it = begin();
@@ -290,6 +646,7 @@ public:
     }
 
     void print() {
+        CONSISTENT_LOCK_SITE("print");
         m.lock();
         std::string offset_space(' ', 3);
         std::cout << "{ size = " << list_size << std::endl;
@@ -310,152 +667,201 @@ public:
     }
 
     std::vector<T> to_vector() {
+        CONSISTENT_LOCK_SITE("to_vector");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::TO_VECTOR);
         m.lock();
         std::vector<T> v(list_size);
         int i = 0;
-        for (auto it = begin(); it != end(); it++) {
+        for (auto it = begin(); it != end(); ++it) {
             v[i++] = *it;
         }
         m.unlock();
         return v;
     }
 
-    class consistent_iterator {
-    private:
-        std::recursive_mutex &m;
-        Node *node = nullptr;
+    /*
+     * Bulk algorithms. fn, pred and transform get the values in order (in any
+     * order and concurrently with par) while the list is locked, so they must
+     * not change the list. reduce must be associative.
+     */
+    template<typename F>
+    void for_each(F fn) {
+        for_each(consistent_execution::seq, fn);
+    }
+
+    template<typename F>
+    void for_each(consistent_execution::sequenced_policy, F fn) {
+        CONSISTENT_LOCK_SITE("for_each");
+        m.lock();
+        for (Node *node = first; node != END_NODE; node = node->next) {
+            fn(node->value);
+        }
+        m.unlock();
+    }
 
-        Node *get_not_deleted_prev(Node *node_) {
-            Node *prev = node_->prev;
-            Node *end_node = node_->base_list->END_NODE;
-            while (prev->is_deleted && prev != end_node) {
-                prev = prev->prev;
+    template<typename F>
+    void for_each(consistent_execution::parallel_policy policy, F fn) {
+        CONSISTENT_LOCK_SITE("for_each");
+        m.lock();
+        run_parallel(policy.pool, split(policy.pool), [&fn](size_t, Node *from, Node *to) {
+            for (Node *node = from; node != to; node = node->next) {
+                fn(node->value);
             }
-            return prev;
+        });
+        m.unlock();
+    }
+
+    template<typename R, typename Reduce, typename Transform>
+    R transform_reduce(consistent_execution::sequenced_policy, R init, Reduce reduce, Transform transform) {
+        CONSISTENT_LOCK_SITE("reduce");
+        m.lock();
+        for (Node *node = first; node != END_NODE; node = node->next) {
+            init = reduce(std::move(init), transform(node->value));
         }
+        m.unlock();
+        return init;
+    }
 
-        Node *get_not_deleted_next(Node *node_) {
-            Node *next = node_->next;
-            Node *end_node = node_->base_list->END_NODE;
-            while (next->is_deleted && next != end_node) {
-                next = next->next;
+    template<typename R, typename Reduce, typename Transform>
+    R transform_reduce(consistent_execution::parallel_policy policy, R init, Reduce reduce, Transform transform) {
+        CONSISTENT_LOCK_SITE("reduce");
+        m.lock();
+        auto starts = split(policy.pool);
+        // every run has at least one node
+        std::vector<std::optional<R>> results(starts.size());
+        run_parallel(policy.pool, starts, [&](size_t i, Node *from, Node *to) {
+            R res = transform(from->value);
+            for (Node *node = from->next; node != to; node = node->next) {
+                res = reduce(std::move(res), transform(node->value));
             }
-            return next;
+            results[i] = std::move(res);
+        });
+        m.unlock();
+
+        for (auto &res: results) {
+            init = reduce(std::move(init), std::move(*res));
         }
+        return init;
+    }
+
+    template<typename Policy, typename P>
+    size_t count_if(Policy policy, P pred) {
+        return transform_reduce(policy, size_t(0), std::plus<>(), [&pred](const T &value) -> size_t {
+            return pred(value) ? 1 : 0;
+        });
+    }
+
+    template<typename P>
+    size_t count_if(P pred) {
+        return count_if(consistent_execution::seq, pred);
+    }
+
+    /*
+     * Pins its node, so the node stays valid after it's erased. Moving and
+     * comparing don't lock the list: moving pins the next live node before
+     * releasing the current one.
+     */
+    class consistent_iterator {
+    private:
+        Node *node = nullptr;
+
+        class adopt_pin {
+        };
+
+        // takes over a pin already made by step()
+        consistent_iterator(Node *node_, adopt_pin) : node(node_) {}
+
+        friend class consistent_linked_list<T>;
 
     public:
-        consistent_iterator(Node *node_) : m(node_->base_list->m) {
-            node = node_;
-            node->add_ref_count(1);
+        consistent_iterator(Node *node_) : node(node_) {
+            node->pin();
         }
 
         consistent_iterator(const consistent_iterator &original) :
                 consistent_iterator(original.node) {}
 
+        consistent_iterator &operator=(const consistent_iterator &rhs) {
+            rhs.node->pin();
+            node->unpin();
+            node = rhs.node;
+            return *this;
+        }
+
         ~consistent_iterator() {
-            node->add_ref_count(-1);
+            node->unpin();
         }
 
-        T operator*() {
+        T &operator*() const {
             return node->value;
         }
 
-        Node *get_node() {
+        Node *get_node() const {
             return node;
         }
 
         // prefix++
-        consistent_iterator operator++() {
-            m.lock();
+        consistent_iterator &operator++() {
+            CONSISTENT_STATS_SCOPE(node->base_list->stats_, stats_op::ITERATE);
             if (node == node->base_list->END_NODE) {
-                m.unlock();
                 throw consistent_linked_list_exception("No more element.");
             }
 
-            Node *next = get_not_deleted_next(node);
-
-            node->add_ref_count(-1);
-            node = next;
-            node->add_ref_count(1);
-
-            auto res = consistent_iterator(node);
-            m.unlock();
-            return res;
+            node = node->base_list->step(node, true, true);
+            return *this;
         }
 
-        // postfix++
+        // postfix++, the old pin goes to the returned iterator
         consistent_iterator operator++(int) {
-            m.lock();
+            CONSISTENT_STATS_SCOPE(node->base_list->stats_, stats_op::ITERATE);
             if (node == node->base_list->END_NODE) {
-                m.unlock();
                 throw consistent_linked_list_exception("No more element.");
             }
 
-            Node *next = get_not_deleted_next(node);
-            consistent_iterator temp = consistent_iterator(node);
-
-            node->add_ref_count(-1);
-            node = next;
-            node->add_ref_count(1);
-
-            m.unlock();
+            consistent_iterator temp(node, adopt_pin());
+            node = node->base_list->step(node, true, false);
             return temp;
         }
 
         // prefix--
-        consistent_iterator operator--() {
-            m.lock();
-            Node *prev = get_not_deleted_prev(node);
+        consistent_iterator &operator--() {
+            CONSISTENT_STATS_SCOPE(node->base_list->stats_, stats_op::ITERATE);
+            Node *prev = node->base_list->step(node, false, false);
 
             if (prev == node->base_list->END_NODE) {
-                m.unlock();
                 throw consistent_linked_list_exception("It's first element.");
             }
 
-            node->add_ref_count(-1);
+            node->unpin();
             node = prev;
-            prev->add_ref_count(1);
-
-            auto res = consistent_iterator(node);
-            m.unlock();
-            return res;
+            return *this;
         }
 
         // postfix--
         consistent_iterator operator--(int) {
-            m.lock();
-            Node *prev = get_not_deleted_prev(node);
+            CONSISTENT_STATS_SCOPE(node->base_list->stats_, stats_op::ITERATE);
+            Node *prev = node->base_list->step(node, false, false);
 
             if (prev == node->base_list->END_NODE) {
-                m.unlock();
                 throw consistent_linked_list_exception("It's first element.");
             }
 
-            consistent_iterator temp = consistent_iterator(node);
-
-            node->add_ref_count(-1);
+            consistent_iterator temp(node, adopt_pin());
             node = prev;
-            node->add_ref_count(1);
-
-            m.unlock();
             return temp;
         }
 
-        bool operator!=(consistent_iterator rhs) const {
-            m.lock();
-            bool b = &(*this->node) != &(*rhs.node);
-            m.unlock();
-            return b;
+        // a pinned node can't be freed and reused, so comparing the pointers is enough
+        bool operator!=(const consistent_iterator &rhs) const {
+            return node != rhs.node;
         }
 
-        bool operator==(consistent_iterator rhs) const {
-            m.lock();
-            bool b = &(*this->node) == &(*rhs.node);
-            m.unlock();
-            return b;
+        bool operator==(const consistent_iterator &rhs) const {
+            return node == rhs.node;
         }
 
         void erase() {
+            mutex_t &m = node->base_list->m;
             m.lock();
             if (node->is_deleted)
                 m.unlock();
@@ -466,29 +872,31 @@ public:
         }
 
         static consistent_iterator next(consistent_iterator it) {
-            if (it.get_node() == it.get_node()->base_list->END_NODE) {
-                throw consistent_linked_list_exception("No more elements");
-            }
-
-            Node *next = it.get_not_deleted_next(it.get_node());
-
-            it.get_node()->add_ref_count(-1);
-            next->add_ref_count(1);
-            return consistent_iterator(next);
+            return ++it;
         }
 
         static consistent_iterator prev(consistent_iterator it) {
-            Node *prev = it.get_not_deleted_prev(it.get_node());
+            return --it;
+        }
+    };
 
-            if (prev == it.get_node()->base_list->END_NODE) {
-                throw consistent_linked_list_exception("It's first element.");
-            }
+    // pins a node like an iterator does and gives access to its value without copying
+    class value_guard {
+    private:
+        consistent_iterator it;
+    public:
+        explicit value_guard(Node *node_) : it(node_) {}
 
+        T &get() {
+            return it.get_node()->value;
+        }
 
-            it.get_node()->add_ref_count(-1);
-            prev->add_ref_count(1);
-            return consistent_iterator(prev);
+        T &operator*() {
+            return get();
         }
-    };
 
+        T *operator->() {
+            return &get();
+        }
+    };
 };
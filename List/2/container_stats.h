@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+/*
+ * Opt-in latency statistics of the consistent containers. Define
+ * CONSISTENT_STATS (cmake -DCONSISTENT_STATS=ON) to record them; without it
+ * the recording compiles to nothing and stats() returns empty histograms.
+ */
+
+enum class stats_op : uint8_t {
+    INSERT, ERASE, FIND, ITERATE, TO_VECTOR, FINALLY_ERASE, LOCK_WAIT, LOCK_WAIT_SHARED, N_OPS
+};
+
+inline const char *stats_op_name(stats_op op) {
+    static const char *names[] = {
+            "insert", "erase", "find", "iterate", "to_vector", "finally_erase", "lock_wait", "lock_wait_shared"
+    };
+    return names[(size_t) op];
+}
+
+/*
+ * HDR-style histogram of nanoseconds: values below SUB_BUCKETS have their own
+ * buckets, every next power of two is split into SUB_BUCKETS linear buckets,
+ * so a bucket is at most 1/SUB_BUCKETS of its value wide.
+ */
+class latency_histogram {
+public:
+    static const size_t SUB_BUCKET_BITS = 3;
+    static const size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    // about 18 minutes, longer values are counted as this
+    static const size_t MAX_VALUE_BITS = 40;
+    static const size_t N_BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    uint64_t counts[N_BUCKETS] = {};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    static size_t bucket(uint64_t value) {
+        if (value >= (uint64_t(1) << MAX_VALUE_BITS)) {
+            value = (uint64_t(1) << MAX_VALUE_BITS) - 1;
+        }
+        if (value < SUB_BUCKETS) {
+            return value;
+        }
+
+        size_t msb = 63 - __builtin_clzll(value);
+        size_t sub = (value >> (msb - SUB_BUCKET_BITS)) - SUB_BUCKETS;
+        return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    // the smallest value of the bucket
+    static uint64_t bucket_value(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+
+        size_t msb = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        return (SUB_BUCKETS + index % SUB_BUCKETS) << (msb - SUB_BUCKET_BITS);
+    }
+
+    double mean() const {
+        return count == 0 ? 0 : (double) sum / (double) count;
+    }
+
+    // value below which the fraction p of the recorded values lies, p in [0, 1]
+    uint64_t percentile(double p) const {
+        if (count == 0) {
+            return 0;
+        }
+
+        uint64_t rank = (uint64_t) (p * (double) (count - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < N_BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen == count) {
+                return max;
+            }
+            if (seen >= rank) {
+                return std::min(bucket_value(i), max);
+            }
+        }
+        return max;
+    }
+
+    void merge(const latency_histogram &rhs) {
+        for (size_t i = 0; i < N_BUCKETS; ++i) {
+            counts[i] += rhs.counts[i];
+        }
+        count += rhs.count;
+        sum += rhs.sum;
+        max = std::max(max, rhs.max);
+    }
+};
+
+// snapshot of a container's histograms
+class container_stats {
+public:
+    latency_histogram ops[(size_t) stats_op::N_OPS];
+
+    const latency_histogram &operator[](stats_op op) const {
+        return ops[(size_t) op];
+    }
+
+    // one line per operation that happened, times in nanoseconds
+    void dump(std::ostream &out) const {
+        out << std::left << std::setw(18) << "op" << std::right
+            << std::setw(12) << "count" << std::setw(10) << "mean"
+            << std::setw(10) << "p50" << std::setw(10) << "p90" << std::setw(10) << "p99"
+            << std::setw(10) << "p99.9" << std::setw(12) << "max" << "\n";
+        for (size_t i = 0; i < (size_t) stats_op::N_OPS; ++i) {
+            const latency_histogram &h = ops[i];
+            if (h.count == 0) {
+                continue;
+            }
+            out << std::left << std::setw(18) << stats_op_name((stats_op) i) << std::right
+                << std::setw(12) << h.count << std::setw(10) << (uint64_t) h.mean()
+                << std::setw(10) << h.percentile(0.5) << std::setw(10) << h.percentile(0.9)
+                << std::setw(10) << h.percentile(0.99) << std::setw(10) << h.percentile(0.999)
+                << std::setw(12) << h.max << "\n";
+        }
+    }
+};
+
+#ifdef CONSISTENT_STATS
+
+/*
+ * Live histograms of one container. Threads write into one of N_STRIPES
+ * copies picked by a per-thread index, so threads rarely share cache lines;
+ * snapshot() merges the stripes.
+ */
+class stats_recorder {
+public:
+    static const size_t N_STRIPES = 8;
+
+private:
+    class alignas(64) stripe {
+    public:
+        std::atomic<uint64_t> counts[(size_t) stats_op::N_OPS][latency_histogram::N_BUCKETS] = {};
+        std::atomic<uint64_t> sum[(size_t) stats_op::N_OPS] = {};
+        std::atomic<uint64_t> max[(size_t) stats_op::N_OPS] = {};
+    };
+
+    stripe stripes[N_STRIPES];
+
+    static size_t stripe_index() {
+        static std::atomic<size_t> n_threads{0};
+        static thread_local size_t index = n_threads.fetch_add(1, std::memory_order_relaxed) % N_STRIPES;
+        return index;
+    }
+
+public:
+    void record(stats_op op, uint64_t nanoseconds) {
+        stripe &s = stripes[stripe_index()];
+        size_t i = (size_t) op;
+        s.counts[i][latency_histogram::bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        s.sum[i].fetch_add(nanoseconds, std::memory_order_relaxed);
+
+        uint64_t max = s.max[i].load(std::memory_order_relaxed);
+        while (max < nanoseconds && !s.max[i].compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+        }
+    }
+
+    container_stats snapshot() const {
+        container_stats res;
+        for (auto &s: stripes) {
+            for (size_t i = 0; i < (size_t) stats_op::N_OPS; ++i) {
+                latency_histogram &h = res.ops[i];
+                for (size_t j = 0; j < latency_histogram::N_BUCKETS; ++j) {
+                    uint64_t n = s.counts[i][j].load(std::memory_order_relaxed);
+                    h.counts[j] += n;
+                    h.count += n;
+                }
+                h.sum += s.sum[i].load(std::memory_order_relaxed);
+                h.max = std::max(h.max, s.max[i].load(std::memory_order_relaxed));
+            }
+        }
+        return res;
+    }
+};
+
+// records the lifetime of the scope
+class stats_timer {
+private:
+    stats_recorder &recorder;
+    stats_op op;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    stats_timer(stats_recorder &recorder_, stats_op op_) :
+            recorder(recorder_), op(op_), start(std::chrono::steady_clock::now()) {}
+
+    ~stats_timer() {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        recorder.record(op, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+};
+
+// mutex with the same interface that records how long every acquisition waited
+template<typename Mutex>
+class stats_mutex {
+private:
+    Mutex mutex_;
+    stats_recorder *recorder;
+
+    template<typename F>
+    void timed(stats_op op, F lock_) {
+        auto start = std::chrono::steady_clock::now();
+        lock_();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        recorder->record(op, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+public:
+    explicit stats_mutex(stats_recorder *recorder_) : recorder(recorder_) {}
+
+    void lock() {
+        // an uncontended lock is recorded without reading the clock
+        if (mutex_.try_lock()) {
+            recorder->record(stats_op::LOCK_WAIT, 0);
+            return;
+        }
+        timed(stats_op::LOCK_WAIT, [this] { mutex_.lock(); });
+    }
+
+    bool try_lock() {
+        if (!mutex_.try_lock()) {
+            return false;
+        }
+        recorder->record(stats_op::LOCK_WAIT, 0);
+        return true;
+    }
+
+    void unlock() {
+        mutex_.unlock();
+    }
+
+    void lock_shared() {
+        if (mutex_.try_lock_shared()) {
+            recorder->record(stats_op::LOCK_WAIT_SHARED, 0);
+            return;
+        }
+        timed(stats_op::LOCK_WAIT_SHARED, [this] { mutex_.lock_shared(); });
+    }
+
+    bool try_lock_shared() {
+        if (!mutex_.try_lock_shared()) {
+            return false;
+        }
+        recorder->record(stats_op::LOCK_WAIT_SHARED, 0);
+        return true;
+    }
+
+    void unlock_shared() {
+        mutex_.unlock_shared();
+    }
+};
+
+#define CONSISTENT_STATS_SCOPE(recorder, op) stats_timer stats_timer_((recorder), (op))
+
+#else
+
+#define CONSISTENT_STATS_SCOPE(recorder, op)
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "iostream"
 #include "vector"
+#include <memory>
 
 #include "utils.h"
 #include "consistent_linked_list.h"
@@ -264,6 +265,29 @@ namespace func_tests {
         }
     }
 
+    void read_only_queries() {
+        test_case = "read_only_queries";
+        consistent_linked_list<int> list;
+        REQUIRE(!list.contains(1) && list.count(1) == 0);
+        REQUIRE(!list.try_get(1) && !list.lower_bound_value(1));
+
+        for (int value: {40, 10, 30, 10, 20}) {
+            list.push_back(value);
+        }
+        list.erase(30);
+        REQUIRE(list.contains(10) && !list.contains(30) && !list.contains(25));
+        REQUIRE(list.count(10) == 2 && list.count(20) == 1 && list.count(30) == 0);
+        REQUIRE(list.try_get(20) == 20 && !list.try_get(30));
+        REQUIRE(list.lower_bound_value(11) == 20 && list.lower_bound_value(21) == 40);
+        REQUIRE(list.lower_bound_value(10) == 10 && !list.lower_bound_value(41));
+
+        // an iterator on an erased node doesn't make it visible, and nothing new gets pinned
+        auto it = list.find(40);
+        list.erase(40);
+        REQUIRE(!list.contains(40) && !list.lower_bound_value(21));
+        REQUIRE(list.metrics().pinned_nodes == 1);
+    }
+
     void to_vector() {
         test_case = "to_vector";
         consistent_linked_list<int> list;
@@ -279,6 +303,173 @@ namespace func_tests {
         REQUIRE(v == list.to_vector());
     }
 
+    void move_only() {
+        test_case = "move_only";
+        consistent_linked_list<unique_ptr<int>> list;
+
+        for (int i = 0; i < N_TEST; ++i) {
+            list.push_back(make_unique<int>(i));
+            list.emplace_front(new int(-i - 1));
+        }
+        REQUIRE(list.size() == 2 * N_TEST);
+
+        int expected = -N_TEST;
+        for (auto it = list.begin(); it != list.end(); it++) {
+            REQUIRE(**it == expected++);
+        }
+
+        auto front = list.front_guard();
+        list.pop_first();
+        REQUIRE(**front == -N_TEST);
+        REQUIRE(*list.front_guard().get() == -N_TEST + 1);
+        REQUIRE(*list.back_guard().get() == N_TEST - 1);
+
+        while (!list.empty()) {
+            list.pop_last();
+        }
+        bool thrown = false;
+        try {
+            list.back_guard();
+        } catch (consistent_linked_list_exception &e) {
+            thrown = true;
+        }
+        REQUIRE(thrown);
+    }
+
+    void iterate_erased() {
+        test_case = "iterate_erased";
+        consistent_linked_list<int> list;
+        fill_range(list, 0, 9);
+
+        {
+            auto it = list.find(3);
+            auto copy = it;
+            copy = list.find(7);
+            list.erase(3);
+            list.erase(4);
+            list.erase(2);
+            list.erase(5);
+            list.erase(7);
+            REQUIRE(*it == 3 && *copy == 7);
+
+            auto prev = it;
+            --prev;
+            REQUIRE(*prev == 1);
+            ++it;
+            REQUIRE(*it == 6);
+            ++copy;
+            REQUIRE(*copy == 8);
+            REQUIRE(list.metrics().tombstones == 0);
+        }
+
+        REQUIRE(list.to_vector() == vector<int>({0, 1, 6, 8, 9}));
+        container_metrics m = list.metrics();
+        REQUIRE(m.frees == 5 && m.pinned_nodes == 0);
+    }
+
+    void bulk_algorithms() {
+        test_case = "bulk_algorithms";
+        using namespace consistent_execution;
+        thread_pool pool(4);
+        consistent_linked_list<int> list;
+
+        REQUIRE(list.count_if(par(pool), [](int) { return true; }) == 0);
+
+        const int size = 1e5;
+        fill_range(list, 0, size - 1);
+        for (int i = 0; i < 10; ++i) {
+            list.pop_first();
+        }
+
+        atomic<long long> sum = 0;
+        list.for_each(par(pool), [&sum](int value) { sum += value; });
+        long long expected_sum = (long long) size * (size - 1) / 2 - 45;
+        REQUIRE(sum == expected_sum);
+
+        sum = 0;
+        list.for_each([&sum](int value) { sum += value; });
+        REQUIRE(sum == expected_sum);
+
+        auto plus = [](long long a, long long b) { return a + b; };
+        auto identity = [](int value) { return (long long) value; };
+        REQUIRE(list.transform_reduce(par(pool), 0LL, plus, identity) == expected_sum);
+        REQUIRE(list.transform_reduce(seq, 0LL, plus, identity) == expected_sum);
+
+        // concatenation isn't commutative, so this checks that runs are reduced in order
+        auto concat = [](vector<int> a, const vector<int> &b) {
+            a.insert(a.end(), b.begin(), b.end());
+            return a;
+        };
+        auto single = [](int value) { return vector<int>{value}; };
+        REQUIRE(list.transform_reduce(par(pool), vector<int>(), concat, single) == list.to_vector());
+
+        auto even = [](int value) { return value % 2 == 0; };
+        REQUIRE(list.count_if(par(pool), even) == (size - 10) / 2);
+        REQUIRE(list.count_if(even) == (size - 10) / 2);
+    }
+
+    void stats() {
+        test_case = "stats";
+        consistent_linked_list<int> list;
+        fill_range(list, 0, N_TEST - 1);
+        for (int i = 0; i < N_TEST / 2; ++i) {
+            list.erase(i);
+            list.contain(i);
+        }
+
+        container_stats stats = list.stats();
+#ifdef CONSISTENT_STATS
+        REQUIRE(stats[stats_op::INSERT].count == N_TEST);
+        REQUIRE(stats[stats_op::ERASE].count == N_TEST / 2);
+        REQUIRE(stats[stats_op::FIND].count == N_TEST / 2);
+        REQUIRE(stats[stats_op::LOCK_WAIT].count >= 2 * N_TEST);
+#else
+        REQUIRE(stats[stats_op::INSERT].count == 0);
+#endif
+    }
+
+    void lock_profiling() {
+        test_case = "lock_profiling";
+        consistent_linked_list<int> list;
+        fill_range(list, 0, N_TEST - 1);
+        for (auto it = list.begin(); it != list.end(); it++) {
+        }
+
+        lock_stats_snapshot stats = list.lock_stats();
+#ifdef CONSISTENT_LOCK_PROFILING
+        REQUIRE(stats.find("push_back") != nullptr);
+        REQUIRE(stats.find("push_back")->exclusive.acquisitions == N_TEST);
+        // iterators move and compare without locking
+        REQUIRE(stats.find("iterator++") == nullptr);
+        REQUIRE(stats.find("iterator==") == nullptr);
+        REQUIRE(stats.find("pop_first") == nullptr);
+#else
+        REQUIRE(stats.sites.empty());
+#endif
+    }
+
+    void metrics() {
+        test_case = "metrics";
+        consistent_linked_list<int> list;
+        fill_range(list, 0, N_TEST - 1);
+
+        {
+            auto it_1 = list.find(10);
+            auto it_2 = list.find(10);
+            auto it_3 = list.find(20);
+            REQUIRE(list.metrics().pinned_nodes == 2);
+
+            list.erase(10);
+            list.erase(30);
+            container_metrics m = list.metrics();
+            REQUIRE(m.tombstones == 1 && m.frees == 1);
+            REQUIRE(m.rotations == 0 && m.height == 0);
+        }
+
+        container_metrics m = list.metrics();
+        REQUIRE(m.tombstones == 0 && m.pinned_nodes == 0 && m.frees == 2);
+    }
+
     void start() {
         push_back();
         push_front();
@@ -295,8 +486,15 @@ namespace func_tests {
         size_random();
         erase();
         contain();
+        read_only_queries();
         to_vector();
         find();
+        move_only();
+        iterate_erased();
+        bulk_algorithms();
+        stats();
+        lock_profiling();
+        metrics();
 
         cout << "Function tests passed. Nice!" << endl;
     }
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+/*
+ * Opt-in lock contention profiling of the consistent containers. Define
+ * CONSISTENT_LOCK_PROFILING (cmake -DCONSISTENT_LOCK_PROFILING=ON) to count
+ * acquisitions, contention, wait and hold times of the container mutex per
+ * call site; without it the call site markers compile to nothing and
+ * lock_stats() is empty.
+ */
+
+class lock_counters {
+public:
+    uint64_t acquisitions = 0;
+    // acquisitions that had to wait
+    uint64_t contended = 0;
+    // try_lock calls that failed, e.g. writers waiting in the combining loop
+    uint64_t failed_tries = 0;
+    uint64_t total_wait_ns = 0;
+    uint64_t max_wait_ns = 0;
+    uint64_t total_hold_ns = 0;
+    uint64_t max_hold_ns = 0;
+};
+
+class lock_site_stats {
+public:
+    const char *site = nullptr;
+    lock_counters exclusive;
+    lock_counters shared;
+};
+
+class lock_stats_snapshot {
+public:
+    std::vector<lock_site_stats> sites;
+
+    // nullptr if nothing was locked from the site
+    const lock_site_stats *find(const char *site) const {
+        for (auto &it: sites) {
+            if (std::strcmp(it.site, site) == 0) {
+                return &it;
+            }
+        }
+        return nullptr;
+    }
+
+    // one line per call site and lock mode, times in nanoseconds
+    void dump(std::ostream &out) const {
+        out << std::left << std::setw(14) << "site" << std::setw(11) << "mode" << std::right
+            << std::setw(12) << "acquired" << std::setw(12) << "contended" << std::setw(12) << "failed try"
+            << std::setw(14) << "total wait" << std::setw(12) << "max wait"
+            << std::setw(14) << "total hold" << std::setw(12) << "max hold" << "\n";
+        for (auto &it: sites) {
+            dump_line(out, it.site, "exclusive", it.exclusive);
+            dump_line(out, it.site, "shared", it.shared);
+        }
+    }
+
+private:
+    static void dump_line(std::ostream &out, const char *site, const char *mode, const lock_counters &c) {
+        if (c.acquisitions == 0 && c.failed_tries == 0) {
+            return;
+        }
+        out << std::left << std::setw(14) << site << std::setw(11) << mode << std::right
+            << std::setw(12) << c.acquisitions << std::setw(12) << c.contended << std::setw(12) << c.failed_tries
+            << std::setw(14) << c.total_wait_ns << std::setw(12) << c.max_wait_ns
+            << std::setw(14) << c.total_hold_ns << std::setw(12) << c.max_hold_ns << "\n";
+    }
+};
+
+// calls dump() every interval on its own thread until destroyed
+class periodic_dumper {
+private:
+    std::mutex mutex_;
+    std::condition_variable cv;
+    bool stopped = false;
+    std::thread thread;
+
+public:
+    periodic_dumper(std::chrono::milliseconds interval, std::function<void()> dump) {
+        thread = std::thread([this, interval, dump] {
+            std::unique_lock lock(mutex_);
+            while (!cv.wait_for(lock, interval, [this] { return stopped; })) {
+                dump();
+            }
+        });
+    }
+
+    periodic_dumper(const periodic_dumper &) = delete;
+
+    periodic_dumper &operator=(const periodic_dumper &) = delete;
+
+    ~periodic_dumper() {
+        {
+            std::unique_lock lock(mutex_);
+            stopped = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+};
+
+#ifdef CONSISTENT_LOCK_PROFILING
+
+/*
+ * The call site of a public operation. The outermost marker on the stack
+ * wins, so the locks taken by helpers are charged to the operation that
+ * called them.
+ */
+class lock_site_scope {
+private:
+    bool owner = false;
+
+public:
+    static const char *&current() {
+        static thread_local const char *site = nullptr;
+        return site;
+    }
+
+    explicit lock_site_scope(const char *site) {
+        if (current() == nullptr) {
+            current() = site;
+            owner = true;
+        }
+    }
+
+    lock_site_scope(const lock_site_scope &) = delete;
+
+    ~lock_site_scope() {
+        if (owner) {
+            current() = nullptr;
+        }
+    }
+};
+
+// live counters of one container mutex
+class lock_profile {
+public:
+    static const size_t N_SITES = 32;
+
+private:
+    class live_counters {
+    public:
+        std::atomic<uint64_t> acquisitions{0};
+        std::atomic<uint64_t> contended{0};
+        std::atomic<uint64_t> failed_tries{0};
+        std::atomic<uint64_t> total_wait_ns{0};
+        std::atomic<uint64_t> max_wait_ns{0};
+        std::atomic<uint64_t> total_hold_ns{0};
+        std::atomic<uint64_t> max_hold_ns{0};
+
+        lock_counters load() const {
+            lock_counters res;
+            res.acquisitions = acquisitions.load(std::memory_order_relaxed);
+            res.contended = contended.load(std::memory_order_relaxed);
+            res.failed_tries = failed_tries.load(std::memory_order_relaxed);
+            res.total_wait_ns = total_wait_ns.load(std::memory_order_relaxed);
+            res.max_wait_ns = max_wait_ns.load(std::memory_order_relaxed);
+            res.total_hold_ns = total_hold_ns.load(std::memory_order_relaxed);
+            res.max_hold_ns = max_hold_ns.load(std::memory_order_relaxed);
+            return res;
+        }
+    };
+
+    class alignas(64) site_counters {
+    public:
+        std::atomic<const char *> site{nullptr};
+        live_counters exclusive;
+        live_counters shared;
+    };
+
+    site_counters sites[N_SITES];
+
+    static void update_max(std::atomic<uint64_t> &max, uint64_t value) {
+        uint64_t current = max.load(std::memory_order_relaxed);
+        while (current < value && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    // sites are string literals, so they are compared by address; the last slot
+    // takes everything once the table is full
+    site_counters &get_site(const char *site) {
+        if (site == nullptr) {
+            site = "other";
+        }
+        for (size_t i = 0; i < N_SITES - 1; ++i) {
+            const char *current = sites[i].site.load(std::memory_order_acquire);
+            if (current == nullptr && sites[i].site.compare_exchange_strong(current, site)) {
+                return sites[i];
+            }
+            if (current == site) {
+                return sites[i];
+            }
+        }
+        const char *expected = nullptr;
+        sites[N_SITES - 1].site.compare_exchange_strong(expected, "overflow");
+        return sites[N_SITES - 1];
+    }
+
+    live_counters &counters(const char *site, bool shared) {
+        site_counters &s = get_site(site);
+        return shared ? s.shared : s.exclusive;
+    }
+
+public:
+    void on_acquire(const char *site, bool shared, bool contended, uint64_t wait_ns) {
+        live_counters &c = counters(site, shared);
+        c.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        if (contended) {
+            c.contended.fetch_add(1, std::memory_order_relaxed);
+            c.total_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+            update_max(c.max_wait_ns, wait_ns);
+        }
+    }
+
+    void on_failed_try(const char *site, bool shared) {
+        counters(site, shared).failed_tries.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void on_release(const char *site, bool shared, uint64_t hold_ns) {
+        live_counters &c = counters(site, shared);
+        c.total_hold_ns.fetch_add(hold_ns, std::memory_order_relaxed);
+        update_max(c.max_hold_ns, hold_ns);
+    }
+
+    lock_stats_snapshot snapshot() const {
+        lock_stats_snapshot res;
+        for (auto &s: sites) {
+            const char *site = s.site.load(std::memory_order_acquire);
+            if (site != nullptr) {
+                res.sites.push_back({site, s.exclusive.load(), s.shared.load()});
+            }
+        }
+        return res;
+    }
+};
+
+/*
+ * Mutex with the interface of Mutex that reports to a lock_profile.
+ * Recursive locking (std::recursive_mutex) is timed from the outermost lock.
+ */
+template<typename Mutex>
+class profiled_mutex {
+private:
+    using clock = std::chrono::steady_clock;
+
+    class shared_hold {
+    public:
+        const void *mutex_;
+        const char *site;
+        clock::time_point start;
+    };
+
+    Mutex mutex_;
+    lock_profile *profile;
+
+    // only touched by the thread that holds the mutex exclusively
+    size_t depth = 0;
+    const char *hold_site = nullptr;
+    clock::time_point hold_start;
+
+    // shared holders can't share a member, each thread keeps its own
+    static std::vector<shared_hold> &shared_holds() {
+        static thread_local std::vector<shared_hold> holds;
+        return holds;
+    }
+
+    static uint64_t nanoseconds(clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    }
+
+    void acquired() {
+        if (depth++ == 0) {
+            hold_site = lock_site_scope::current();
+            hold_start = clock::now();
+        }
+    }
+
+    void acquired_shared() {
+        shared_holds().push_back({this, lock_site_scope::current(), clock::now()});
+    }
+
+public:
+    template<typename... Args>
+    explicit profiled_mutex(lock_profile *profile_, Args &&... args) :
+            mutex_(std::forward<Args>(args)...), profile(profile_) {}
+
+    void lock() {
+        const char *site = lock_site_scope::current();
+        if (mutex_.try_lock()) {
+            profile->on_acquire(site, false, false, 0);
+        } else {
+            auto start = clock::now();
+            mutex_.lock();
+            profile->on_acquire(site, false, true, nanoseconds(clock::now() - start));
+        }
+        acquired();
+    }
+
+    bool try_lock() {
+        const char *site = lock_site_scope::current();
+        if (!mutex_.try_lock()) {
+            profile->on_failed_try(site, false);
+            return false;
+        }
+        profile->on_acquire(site, false, false, 0);
+        acquired();
+        return true;
+    }
+
+    void unlock() {
+        if (--depth == 0) {
+            profile->on_release(hold_site, false, nanoseconds(clock::now() - hold_start));
+        }
+        mutex_.unlock();
+    }
+
+    void lock_shared() {
+        const char *site = lock_site_scope::current();
+        if (mutex_.try_lock_shared()) {
+            profile->on_acquire(site, true, false, 0);
+        } else {
+            auto start = clock::now();
+            mutex_.lock_shared();
+            profile->on_acquire(site, true, true, nanoseconds(clock::now() - start));
+        }
+        acquired_shared();
+    }
+
+    bool try_lock_shared() {
+        const char *site = lock_site_scope::current();
+        if (!mutex_.try_lock_shared()) {
+            profile->on_failed_try(site, true);
+            return false;
+        }
+        profile->on_acquire(site, true, false, 0);
+        acquired_shared();
+        return true;
+    }
+
+    void unlock_shared() {
+        auto &holds = shared_holds();
+        for (size_t i = holds.size(); i-- > 0;) {
+            if (holds[i].mutex_ == this) {
+                profile->on_release(holds[i].site, true, nanoseconds(clock::now() - holds[i].start));
+                holds.erase(holds.begin() + (long) i);
+                break;
+            }
+        }
+        mutex_.unlock_shared();
+    }
+};
+
+#define CONSISTENT_LOCK_SITE(site) lock_site_scope lock_site_scope_(site)
+
+#else
+
+#define CONSISTENT_LOCK_SITE(site)
+
+#endif
@@ -6,6 +6,7 @@
 
 #include "utils.h"
 #include "consistent_linked_list.h"
+#include "workload_driver.h"
 
 namespace threads_with_lock_list_tests {
     using namespace std;
@@ -15,6 +16,12 @@ namespace threads_with_lock_list_tests {
 
     string test_case = "NULL";
 
+    // threads are started once and reused by every test
+    workload_driver &driver() {
+        static workload_driver driver_(N_THREADS);
+        return driver_;
+    }
+
     void REQUIRE(bool b) {
         if (!b) {
             throw runtime_error("Fail. Test: " + test_case);
@@ -33,19 +40,11 @@ namespace threads_with_lock_list_tests {
 
         consistent_linked_list<int> list;
 
-        vector<thread> vt(N_THREADS);
-        for (int i = 0; i < N_THREADS; ++i) {
-            vt[i] = thread([&]() -> void {
-                for (int j = 0; j < N_TEST; ++j) {
-                    list.push_back(1);
-                }
-            });
-        }
-
-        for (int i = 0; i < N_THREADS; ++i) {
-            vt[i].join();
-        }
-
+        driver().run([&](size_t) {
+            for (int j = 0; j < N_TEST; ++j) {
+                list.push_back(1);
+            }
+        });
 
         REQUIRE(list.size(), N_THREADS * N_TEST);
     }
@@ -74,21 +73,18 @@ namespace threads_with_lock_list_tests {
             list.push_back(2);
         }
 
-        thread thread1([&]() -> void {
-            for (int i = 0; i < N_ONE; ++i) {
-                list.push_front(1);
-            }
-        });
-
-        thread thread2([&]() -> void {
-            for (int i = 0; i < N_THREE; ++i) {
-                list.push_back(3);
+        driver().run([&](size_t i) {
+            if (i == 0) {
+                for (int j = 0; j < N_ONE; ++j) {
+                    list.push_front(1);
+                }
+            } else if (i == 1) {
+                for (int j = 0; j < N_THREE; ++j) {
+                    list.push_back(3);
+                }
             }
         });
 
-        thread1.join();
-        thread2.join();
-
         REQUIRE(list.to_vector() == ans);
     }
 
@@ -99,18 +95,11 @@ namespace threads_with_lock_list_tests {
 
         consistent_linked_list<int> list(t);
 
-        vector<thread> vt(N_THREADS);
-        for (int i = 0; i < N_THREADS; ++i) {
-            vt[i] = thread([&]() -> void {
-                for (int j = 0; j < N_TEST; ++j) {
-                    list.pop_first();
-                }
-            });
-        }
-
-        for (int i = 0; i < N_THREADS; ++i) {
-            vt[i].join();
-        }
+        driver().run([&](size_t) {
+            for (int j = 0; j < N_TEST; ++j) {
+                list.pop_first();
+            }
+        });
 
         REQUIRE(list.size(), 0);
     }
@@ -122,18 +111,11 @@ namespace threads_with_lock_list_tests {
 
         consistent_linked_list<int> list(t);
 
-        vector<thread> vt(N_THREADS);
-        for (int i = 0; i < N_THREADS; ++i) {
-            vt[i] = thread([&]() -> void {
-                for (int j = 0; j < N_TEST; ++j) {
-                    list.pop_last();
-                }
-            });
-        }
-
-        for (int i = 0; i < N_THREADS; ++i) {
-            vt[i].join();
-        }
+        driver().run([&](size_t) {
+            for (int j = 0; j < N_TEST; ++j) {
+                list.pop_last();
+            }
+        });
 
         REQUIRE(list.size(), 0);
     }
@@ -144,23 +126,16 @@ namespace threads_with_lock_list_tests {
         vector<int> t(2 * N_TEST, 1);
         consistent_linked_list<int> list(t);
 
-        vector<thread> vt(N_THREADS);
-        vt[0] = thread([&]() -> void {
-            for (int j = 0; j < N_TEST; ++j) {
-                list.pop_first();
-            }
-        });
-        vt[1] = thread([&]() -> void {
-            for (int j = 0; j < N_TEST; ++j) {
-                list.pop_last();
+        driver().run([&](size_t i) {
+            for (int j = 0; j < N_TEST && i < 2; ++j) {
+                if (i == 0) {
+                    list.pop_first();
+                } else {
+                    list.pop_last();
+                }
             }
         });
 
-
-        for (int i = 0; i < 2; ++i) {
-            vt[i].join();
-        }
-
         REQUIRE(list.size(), 0);
     }
 
@@ -175,23 +150,92 @@ namespace threads_with_lock_list_tests {
 
         random_shuffle(numbers.begin(), numbers.end());
 
-        vector<thread> vt(N_THREADS);
-        mutex m;
-        for (int i = 0; i < N_THREADS; ++i) {
-            vt[i] = thread([&, i]() -> void {
-                for (int j = i * N_TEST; j < (i + 1) * N_TEST; ++j) {
+        driver().run([&](size_t i) {
+            for (int j = i * N_TEST; j < (i + 1) * N_TEST; ++j) {
+                list.erase(j);
+            }
+        });
+
+        REQUIRE(list.size(), 0);
+    }
+
+    void iterate_while_erasing() {
+        test_case = "iterate_while_erasing";
+
+        vector<int> numbers(N_THREADS * N_TEST);
+        for (int i = 0; i < numbers.size(); ++i) {
+            numbers[i] = i;
+        }
+        consistent_linked_list<int> list(numbers);
+
+        // thread 0 walks the list while the others erase all but the multiples of N_THREADS
+        driver().run([&](size_t i) {
+            if (i == 0) {
+                for (int round = 0; round < N_TEST; ++round) {
+                    int last = -1;
+                    for (auto it = list.begin(); it != list.end(); ++it) {
+                        REQUIRE(*it > last);
+                        last = *it;
+                    }
+                }
+            } else {
+                for (int j = (int) i; j < numbers.size(); j += N_THREADS) {
                     list.erase(j);
                 }
-            });
-        }
+            }
+        });
+
+        REQUIRE(list.size(), N_TEST);
+        REQUIRE(list.metrics().tombstones == 0);
+    }
 
-        for (int i = 0; i < N_THREADS; ++i) {
-            vt[i].join();
+    void erase_while_iterating() {
+        test_case = "erase_while_iterating";
+
+        int n_numbers = 100 * N_TEST;
+        vector<int> numbers(n_numbers);
+        for (int i = 0; i < numbers.size(); ++i) {
+            numbers[i] = i;
         }
+        consistent_linked_list<int> list(numbers);
+
+        // thread 0 erases everything while the others keep iterating
+        atomic<bool> done = false;
+        size_t max_retired = 0;
+        driver().run([&](size_t i) {
+            if (i == 0) {
+                for (int j = 0; j < n_numbers; ++j) {
+                    list.erase(j);
+                    max_retired = max(max_retired, list.n_retired());
+                }
+                done = true;
+                return;
+            }
+
+            while (!done) {
+                for (auto it = list.begin(); it != list.end() && !done; ++it) {
+                }
+            }
+        });
 
+        REQUIRE(max_retired < consistent_linked_list<int>::RETIRED_LIMIT);
         REQUIRE(list.size(), 0);
     }
 
+    void mixed_workload() {
+        test_case = "mixed_workload";
+        consistent_linked_list<int> list;
+
+        size_t ops_per_thread = 1e3;
+        workload_result res = driver().run_mix(list, op_mix{50, 25, 25}, N_TEST, ops_per_thread);
+        REQUIRE(res.ops() == N_THREADS * ops_per_thread);
+        REQUIRE(list.to_vector().size() == list.size());
+
+        res = driver().run_mix_for(list, op_mix{}, N_TEST, chrono::milliseconds(20));
+        REQUIRE(res.ops() > 0);
+        REQUIRE(list.to_vector().size() == list.size());
+    }
+
     void start() {
         push_1();
         push_2();
@@ -199,6 +243,9 @@ namespace threads_with_lock_list_tests {
         pop_last();
         pop_first_and_last();
         erase();
+        iterate_while_erasing();
+        erase_while_iterating();
+        mixed_workload();
 
         std::cout << "Threads tests with lock list passed. Nice!" << endl;
     }
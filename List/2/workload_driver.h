@@ -0,0 +1,214 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// all threads leave wait() together, spinning keeps the start skew small
+class spin_barrier {
+private:
+    const size_t n_threads;
+    std::atomic<size_t> n_waiting{0};
+    std::atomic<size_t> generation{0};
+
+public:
+    explicit spin_barrier(size_t n_threads_) : n_threads(n_threads_) {}
+
+    void wait() {
+        size_t current = generation.load(std::memory_order_acquire);
+        if (n_waiting.fetch_add(1, std::memory_order_acq_rel) + 1 == n_threads) {
+            n_waiting.store(0, std::memory_order_relaxed);
+            generation.fetch_add(1, std::memory_order_release);
+            return;
+        }
+        while (generation.load(std::memory_order_acquire) == current) {
+            std::this_thread::yield();
+        }
+    }
+};
+
+// percentages of operations in a mixed run, insert is push_back
+class op_mix {
+public:
+    unsigned find = 60;
+    unsigned insert = 20;
+    unsigned erase = 20;
+};
+
+class workload_result {
+public:
+    size_t n_find = 0;
+    size_t n_insert = 0;
+    size_t n_erase = 0;
+    double seconds = 0;
+
+    size_t ops() const {
+        return n_find + n_insert + n_erase;
+    }
+
+    double ops_per_second() const {
+        return seconds > 0 ? (double) ops() / seconds : 0;
+    }
+};
+
+/*
+ * Runs the same job on a fixed set of threads. The threads live as long as
+ * the driver, are pinned to cores round-robin, and start every job together
+ * after a barrier, so short runs measure the container rather than thread
+ * creation and scheduling. Jobs use generators seeded by the thread index,
+ * so a run with the same parameters performs the same operations.
+ */
+class workload_driver {
+private:
+    std::vector<std::thread> workers;
+    spin_barrier start_barrier;
+
+    std::mutex mutex_;
+    std::condition_variable cv;
+    std::function<void(size_t)> job;
+    size_t job_generation = 0;
+    size_t n_running = 0;
+    bool stopped = false;
+
+    static void pin(size_t index) {
+#ifdef __linux__
+        size_t n_cores = std::thread::hardware_concurrency();
+        if (n_cores == 0) {
+            return;
+        }
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(index % n_cores, &cpu_set);
+        // pinning is best effort, a restricted cpuset just leaves the thread where it is
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#endif
+    }
+
+    void work(size_t index, bool pinned) {
+        if (pinned) {
+            pin(index);
+        }
+
+        size_t seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock lock(mutex_);
+                cv.wait(lock, [&] { return stopped || job_generation != seen_generation; });
+                if (stopped) {
+                    return;
+                }
+                seen_generation = job_generation;
+            }
+
+            start_barrier.wait();
+            job(index);
+
+            std::unique_lock lock(mutex_);
+            if (--n_running == 0) {
+                cv.notify_all();
+            }
+        }
+    }
+
+    template<typename Container, typename Op>
+    workload_result run_mix_(Container &container, const op_mix &mix, int key_range, Op should_stop) {
+        std::vector<workload_result> results(size());
+        auto start = std::chrono::steady_clock::now();
+
+        run([&](size_t index) {
+            std::minstd_rand generator(index + 1);
+            unsigned total = mix.find + mix.insert + mix.erase;
+            workload_result &res = results[index];
+            for (size_t i = 0; !should_stop(i); ++i) {
+                int key = (int) (generator() % key_range);
+                unsigned op = generator() % total;
+                if (op < mix.insert) {
+                    container.push_back(key);
+                    res.n_insert++;
+                } else if (op < mix.insert + mix.erase) {
+                    container.erase(key);
+                    res.n_erase++;
+                } else {
+                    container.find(key);
+                    res.n_find++;
+                }
+            }
+        });
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        workload_result total;
+        for (auto &res: results) {
+            total.n_find += res.n_find;
+            total.n_insert += res.n_insert;
+            total.n_erase += res.n_erase;
+        }
+        total.seconds = elapsed.count();
+        return total;
+    }
+
+public:
+    explicit workload_driver(size_t n_threads, bool pinned = true) : start_barrier(n_threads) {
+        for (size_t i = 0; i < n_threads; ++i) {
+            workers.emplace_back([this, i, pinned] { work(i, pinned); });
+        }
+    }
+
+    workload_driver(const workload_driver &) = delete;
+
+    workload_driver &operator=(const workload_driver &) = delete;
+
+    ~workload_driver() {
+        {
+            std::unique_lock lock(mutex_);
+            stopped = true;
+        }
+        cv.notify_all();
+        for (auto &worker: workers) {
+            worker.join();
+        }
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    // calls fn(thread_index) on every thread at once and waits for all of them
+    template<typename F>
+    void run(F fn) {
+        std::unique_lock lock(mutex_);
+        job = fn;
+        n_running = size();
+        ++job_generation;
+        cv.notify_all();
+        cv.wait(lock, [this] { return n_running == 0; });
+    }
+
+    // ops_per_thread operations of the mix on keys from [0, key_range)
+    template<typename Container>
+    workload_result run_mix(Container &container, const op_mix &mix, int key_range, size_t ops_per_thread) {
+        return run_mix_(container, mix, key_range, [ops_per_thread](size_t i) {
+            return i == ops_per_thread;
+        });
+    }
+
+    // like run_mix(), but every thread runs for the given time
+    template<typename Container>
+    workload_result run_mix_for(Container &container, const op_mix &mix, int key_range,
+                                std::chrono::milliseconds duration) {
+        auto deadline = std::chrono::steady_clock::now() + duration;
+        return run_mix_(container, mix, key_range, [deadline](size_t i) {
+            // reading the clock on every operation would cost more than most operations
+            return i % 64 == 0 && std::chrono::steady_clock::now() >= deadline;
+        });
+    }
+};
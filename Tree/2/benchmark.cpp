@@ -0,0 +1,147 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <iterator>
+
+#include "consistent_tree.h"
+#include "consistent_skip_list.h"
+#include "sharded_tree.h"
+#include "workload_driver.h"
+
+const int N_KEYS = 1e5;
+const std::chrono::milliseconds DURATION(500);
+
+// 20% insert, 20% erase, 60% find over a key range that is half full
+template<typename Container>
+double run(workload_driver &driver) {
+    Container container;
+    for (int i = 0; i < N_KEYS; i += 2) {
+        container.insert(i);
+    }
+
+    return driver.run_mix_for(container, op_mix{60, 20, 20}, N_KEYS, DURATION).ops_per_second();
+}
+
+// nanoseconds per element of a full scan, best of 5
+template<typename F>
+double scan(F loop) {
+    double best = 0;
+    for (int i = 0; i < 5; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        size_t n = loop();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        best = i == 0 ? elapsed.count() / n : std::min(best, elapsed.count() / n);
+    }
+    return best;
+}
+
+int main() {
+    std::cout << "--benchmark.cpp: mixed 20/20/60 insert/erase/find, ops/sec--\n";
+    std::cout << std::setw(8) << "threads"
+              << std::setw(16) << "avl tree"
+              << std::setw(16) << "skip list"
+              << std::setw(16) << "8 shards" << "\n";
+
+    for (size_t n_threads: {1, 2, 4, 8}) {
+        workload_driver driver(n_threads);
+        std::cout << std::setw(8) << n_threads
+                  << std::setw(16) << (long long) run<consistent_tree<int>>(driver)
+                  << std::setw(16) << (long long) run<consistent_skip_list<int>>(driver)
+                  << std::setw(16) << (long long) run<sharded_tree<int, 8>>(driver) << "\n";
+    }
+
+    consistent_tree<int> tree;
+    for (int i = 0; i < 10 * N_KEYS; ++i) {
+        tree.insert(i);
+    }
+    std::cout << "--scan of " << 10 * N_KEYS << " elements, ns/element--\n";
+    std::cout << std::setw(16) << "(*it).get()" << std::setw(16) << "it.value()"
+              << std::setw(16) << "read_guard" << "\n";
+    long long sum = 0;
+    std::cout << std::setw(16) << scan([&] {
+        size_t n = 0;
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+            sum += (*it).get();
+            n++;
+        }
+        return n;
+    });
+    std::cout << std::setw(16) << scan([&] {
+        size_t n = 0;
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+            sum += it.value();
+            n++;
+        }
+        return n;
+    });
+    std::cout << std::setw(16) << scan([&] {
+        size_t n = 0;
+        auto guard = tree.read();
+        for (auto it = guard.begin(); it != guard.end(); ++it) {
+            sum += *it;
+            n++;
+        }
+        return n;
+    }) << "\n";
+
+    std::vector<int> keys(10 * N_KEYS);
+    std::mt19937 rng(1);
+    for (auto &key: keys) {
+        key = (int) (rng() % (20 * N_KEYS));
+    }
+    std::cout << "--lookup of " << keys.size() << " random keys, ns/key--\n";
+    std::cout << std::setw(16) << "find" << std::setw(16) << "contains_batch" << "\n";
+    std::cout << std::setw(16) << scan([&] {
+        for (int key: keys) {
+            sum += tree.find(key) != tree.end();
+        }
+        return keys.size();
+    });
+    std::cout << std::setw(16) << scan([&] {
+        // a request handler's worth of keys per call
+        const size_t batch_size = 64;
+        std::vector<int> batch;
+        for (size_t i = 0; i < keys.size(); i += batch_size) {
+            batch.assign(keys.begin() + i, keys.begin() + std::min(i + batch_size, keys.size()));
+            for (bool hit: tree.contains_batch(batch)) {
+                sum += hit;
+            }
+        }
+        return keys.size();
+    }) << "\n";
+
+    consistent_tree<int> evens;
+    consistent_tree<int> threes;
+    for (int i = 0; i < 10 * N_KEYS; ++i) {
+        evens.insert(evens.end(), 2 * i);
+        threes.insert(threes.end(), 3 * i);
+    }
+    std::cout << "--difference of two " << 10 * N_KEYS << " element trees into a tree, ns/input element--\n";
+    std::cout << std::setw(16) << "set_difference" << std::setw(16) << "std::" << "\n";
+    std::cout << std::setw(16) << scan([&] {
+        consistent_tree<int> out;
+        evens.set_difference(threes, out);
+        sum += out.size();
+        return 20 * N_KEYS;
+    });
+    std::cout << std::setw(16) << scan([&] {
+        // the same through vectors, with the result appended to a tree
+        auto a = evens.to_vector();
+        auto b = threes.to_vector();
+        std::vector<int> diff;
+        std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(diff));
+        consistent_tree<int> out;
+        for (int value: diff) {
+            out.insert(out.end(), value);
+        }
+        sum += out.size();
+        return 20 * N_KEYS;
+    }) << "\n";
+
+    // keeps the scans from being optimized out
+    return sum == 0 ? 1 : 0;
+}
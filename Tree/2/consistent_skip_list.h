@@ -0,0 +1,607 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "consistent_tree.h"
+
+/*
+ * Lazy-locking skip list (Herlihy, Lev, Luchangco, Shavit) with the same
+ * ordered-set interface as consistent_tree. insert and erase lock only the
+ * predecessors of the node they change, find never locks a node.
+ *
+ * Erased nodes are unlinked at once but freed later: all operations hold
+ * reclaim_mutex_ in shared mode, and retired nodes that no iterator pins are
+ * freed by whoever manages to take it exclusively. So an iterator always
+ * survives erasure of the node it points at. Past RECLAIM_LIMIT retired nodes
+ * an eraser waits for the exclusive lock instead of giving up, and holds back
+ * new readers meanwhile, so constant reads can't grow the backlog unbounded.
+ */
+template<typename T>
+class consistent_skip_list {
+public:
+    using value_t = T;
+    using level_t = int;
+    using ref_count_t = uint32_t;
+
+    static const level_t MAX_LEVEL = 20;
+    static const size_t RECLAIM_THRESHOLD = 64;
+    static const size_t RECLAIM_LIMIT = 4 * RECLAIM_THRESHOLD;
+
+    class node;
+
+    class value_node;
+
+    class iterator;
+
+    class node {
+    public:
+        enum kind_t : uint8_t {
+            HEAD, TAIL, DATA
+        };
+
+        value_t value;
+        kind_t kind;
+        level_t top_level;
+
+        std::unique_ptr<std::atomic<node *>[]> next;
+
+        std::mutex mutex_;
+        std::atomic<bool> marked{false};
+        std::atomic<bool> fully_linked{false};
+        std::atomic<ref_count_t> ref_count{0};
+
+        node(kind_t kind_, level_t top_level_, value_t value_) :
+                value(std::move(value_)), kind(kind_), top_level(top_level_),
+                next(new std::atomic<node *>[top_level_ + 1]) {
+            for (level_t level = 0; level <= top_level; ++level) {
+                next[level].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        node *get_next(level_t level) {
+            return next[level].load(std::memory_order_acquire);
+        }
+
+        void set_next(level_t level, node *node_) {
+            next[level].store(node_, std::memory_order_release);
+        }
+
+        bool is_alive() {
+            return kind == DATA && fully_linked.load(std::memory_order_acquire) &&
+                   !marked.load(std::memory_order_acquire);
+        }
+    };
+
+    class value_node {
+    private:
+        node *current_node;
+    public:
+        explicit value_node(node *node_) : current_node(node_) {}
+
+        const value_t &get() {
+            return current_node->value;
+        }
+    };
+
+
+    node *HEAD_NODE;
+    node *TAIL_NODE;
+    std::atomic<uint32_t> n_deleted_node{0};
+
+    receiver *deleted_node_receiver = nullptr;
+
+    std::atomic<size_t> size_{0};
+
+    std::shared_mutex reclaim_mutex_;
+    // held by a reclaimer that must not be starved, new readers queue on it
+    std::mutex drain_mutex_;
+    std::atomic<bool> draining_{false};
+    std::mutex retired_mutex_;
+    std::vector<node *> retired_;
+
+
+    consistent_skip_list() {
+        HEAD_NODE = new node(node::HEAD, MAX_LEVEL - 1, value_t());
+        TAIL_NODE = new node(node::TAIL, MAX_LEVEL - 1, value_t());
+        for (level_t level = 0; level < MAX_LEVEL; ++level) {
+            HEAD_NODE->set_next(level, TAIL_NODE);
+        }
+        HEAD_NODE->fully_linked = TAIL_NODE->fully_linked = true;
+    }
+
+    explicit consistent_skip_list(receiver *receiver_) : consistent_skip_list() {
+        deleted_node_receiver = receiver_;
+    }
+
+    consistent_skip_list(const consistent_skip_list &) = delete;
+
+    consistent_skip_list &operator=(const consistent_skip_list &) = delete;
+
+    ~consistent_skip_list() {
+        node *node_ = HEAD_NODE->get_next(0);
+        while (node_ != TAIL_NODE) {
+            node *next = node_->get_next(0);
+            free_node(node_);
+            node_ = next;
+        }
+        for (node *retired: retired_) {
+            free_node(retired);
+        }
+
+        delete HEAD_NODE;
+        delete TAIL_NODE;
+        n_deleted_node += 2;
+        if (deleted_node_receiver != nullptr) {
+            deleted_node_receiver->value = n_deleted_node;
+        }
+    }
+
+
+    bool insert(const value_t &value_) {
+        auto gate = read_gate();
+
+        level_t top_level = random_level();
+        node *preds[MAX_LEVEL];
+        node *succs[MAX_LEVEL];
+
+        while (true) {
+            level_t found_level = find(value_, preds, succs);
+            if (found_level != -1) {
+                node *found = succs[found_level];
+                if (!found->marked.load(std::memory_order_acquire)) {
+                    while (!found->fully_linked.load(std::memory_order_acquire)) {
+                        std::this_thread::yield();
+                    }
+                    return false;
+                }
+                continue;
+            }
+
+            level_t highest_locked = -1;
+            bool valid = true;
+            node *prev_pred = nullptr;
+            for (level_t level = 0; valid && level <= top_level; ++level) {
+                node *pred = preds[level];
+                node *succ = succs[level];
+                if (pred != prev_pred) {
+                    pred->mutex_.lock();
+                    highest_locked = level;
+                    prev_pred = pred;
+                }
+                valid = !pred->marked.load(std::memory_order_acquire) &&
+                        !succ->marked.load(std::memory_order_acquire) &&
+                        pred->get_next(level) == succ;
+            }
+
+            if (!valid) {
+                unlock_preds(preds, highest_locked);
+                continue;
+            }
+
+            node *new_node = new node(node::DATA, top_level, value_);
+            for (level_t level = 0; level <= top_level; ++level) {
+                new_node->set_next(level, succs[level]);
+            }
+            for (level_t level = 0; level <= top_level; ++level) {
+                preds[level]->set_next(level, new_node);
+            }
+            new_node->fully_linked.store(true, std::memory_order_release);
+            size_++;
+
+            unlock_preds(preds, highest_locked);
+            return true;
+        }
+    }
+
+    bool erase(const value_t &value_) {
+        return erase_(value_, nullptr);
+    }
+
+    // erases the iterator's own node, false if it is already erased even if the key was inserted again
+    bool erase(const iterator &it) {
+        node *node_ = it.get_node();
+        if (node_->kind != node::DATA || node_->marked.load(std::memory_order_acquire)) {
+            return false;
+        }
+        return erase_(node_->value, node_);
+    }
+
+    iterator find(const value_t &value_) {
+        auto gate = read_gate();
+
+        node *preds[MAX_LEVEL];
+        node *succs[MAX_LEVEL];
+        level_t found_level = find(value_, preds, succs);
+
+        if (found_level != -1 && succs[found_level]->is_alive()) {
+            return iterator(this, succs[found_level]);
+        }
+        return iterator(this, TAIL_NODE);
+    }
+
+    bool empty() {
+        return size_ == 0;
+    }
+
+    size_t size() {
+        return size_;
+    }
+
+    // erased nodes not freed yet
+    size_t retired() {
+        std::lock_guard lock(retired_mutex_);
+        return retired_.size();
+    }
+
+    // a copy of the smallest value, std::nullopt for an empty list
+    std::optional<value_t> front() {
+        auto gate = read_gate();
+        node *node_ = find_next(HEAD_NODE);
+        if (node_ == TAIL_NODE) {
+            return std::nullopt;
+        }
+        return node_->value;
+    }
+
+    std::optional<value_t> back() {
+        auto gate = read_gate();
+        node *node_ = find_prev(TAIL_NODE);
+        if (node_ == TAIL_NODE) {
+            return std::nullopt;
+        }
+        return node_->value;
+    }
+
+
+    iterator begin() {
+        auto gate = read_gate();
+        return iterator(this, find_next(HEAD_NODE));
+    }
+
+    iterator end() {
+        return iterator(this, TAIL_NODE);
+    }
+
+
+    std::vector<value_t> to_vector() {
+        auto gate = read_gate();
+        std::vector<value_t> v;
+        v.reserve(size_);
+        for (node *node_ = find_next(HEAD_NODE); node_ != TAIL_NODE; node_ = find_next(node_)) {
+            v.push_back(node_->value);
+        }
+        return v;
+    }
+
+
+    static level_t random_level() {
+        thread_local std::minstd_rand generator(
+                std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+        level_t level = 0;
+        while (level < MAX_LEVEL - 1 && (generator() & 1)) {
+            level++;
+        }
+        return level;
+    }
+
+    // true if node_ is before value_ in the list
+    static bool less(node *node_, const value_t &value_) {
+        if (node_->kind != node::DATA) {
+            return node_->kind == node::HEAD;
+        }
+        return node_->value < value_;
+    }
+
+    static bool equal(node *node_, const value_t &value_) {
+        return node_->kind == node::DATA && !(node_->value < value_) && !(value_ < node_->value);
+    }
+
+    level_t find(const value_t &value_, node **preds, node **succs) {
+        level_t found_level = -1;
+        node *pred = HEAD_NODE;
+
+        for (level_t level = MAX_LEVEL - 1; level >= 0; --level) {
+            node *curr = pred->get_next(level);
+            while (less(curr, value_)) {
+                pred = curr;
+                curr = pred->get_next(level);
+            }
+            if (found_level == -1 && equal(curr, value_)) {
+                found_level = level;
+            }
+            preds[level] = pred;
+            succs[level] = curr;
+        }
+
+        return found_level;
+    }
+
+    static void unlock_preds(node **preds, level_t highest_locked) {
+        node *prev_pred = nullptr;
+        for (level_t level = 0; level <= highest_locked; ++level) {
+            if (preds[level] != prev_pred) {
+                preds[level]->mutex_.unlock();
+                prev_pred = preds[level];
+            }
+        }
+    }
+
+    // target, if not nullptr, is the only node that may be erased
+    bool erase_(const value_t &value_, node *target) {
+        bool erased;
+        {
+            auto gate = read_gate();
+            erased = try_remove(value_, target);
+        }
+
+        if (erased) {
+            try_reclaim();
+        }
+        return erased;
+    }
+
+    bool try_remove(const value_t &value_, node *target = nullptr) {
+        node *victim = nullptr;
+        bool is_marked = false;
+        level_t top_level = -1;
+
+        node *preds[MAX_LEVEL];
+        node *succs[MAX_LEVEL];
+
+        while (true) {
+            level_t found_level = find(value_, preds, succs);
+            if (!is_marked) {
+                if (found_level == -1) {
+                    return false;
+                }
+
+                victim = succs[found_level];
+                if ((target != nullptr && victim != target) ||
+                    !victim->fully_linked.load(std::memory_order_acquire) ||
+                    victim->top_level != found_level ||
+                    victim->marked.load(std::memory_order_acquire)) {
+                    return false;
+                }
+
+                top_level = victim->top_level;
+                victim->mutex_.lock();
+                if (victim->marked.load(std::memory_order_acquire)) {
+                    victim->mutex_.unlock();
+                    return false;
+                }
+                victim->marked.store(true, std::memory_order_release);
+                size_--;
+                is_marked = true;
+            }
+
+            level_t highest_locked = -1;
+            bool valid = true;
+            node *prev_pred = nullptr;
+            for (level_t level = 0; valid && level <= top_level; ++level) {
+                node *pred = preds[level];
+                if (pred != prev_pred) {
+                    pred->mutex_.lock();
+                    highest_locked = level;
+                    prev_pred = pred;
+                }
+                valid = !pred->marked.load(std::memory_order_acquire) && pred->get_next(level) == victim;
+            }
+
+            if (!valid) {
+                unlock_preds(preds, highest_locked);
+                continue;
+            }
+
+            for (level_t level = top_level; level >= 0; --level) {
+                preds[level]->set_next(level, victim->get_next(level));
+            }
+            victim->mutex_.unlock();
+            unlock_preds(preds, highest_locked);
+
+            std::lock_guard lock(retired_mutex_);
+            retired_.push_back(victim);
+            return true;
+        }
+    }
+
+    // must be called without reclaim_mutex_ held
+    void try_reclaim() {
+        bool must_reclaim;
+        {
+            std::lock_guard lock(retired_mutex_);
+            if (retired_.size() < RECLAIM_THRESHOLD) {
+                return;
+            }
+            must_reclaim = retired_.size() >= RECLAIM_LIMIT;
+        }
+
+        std::unique_lock turnstile(drain_mutex_, std::defer_lock);
+        std::unique_lock gate(reclaim_mutex_, std::defer_lock);
+        if (must_reclaim) {
+            turnstile.lock();
+            draining_.store(true, std::memory_order_release);
+            gate.lock();
+        } else if (!gate.try_lock()) {
+            return;
+        }
+
+        std::lock_guard lock(retired_mutex_);
+        size_t n_pinned = 0;
+        for (node *node_: retired_) {
+            if (node_->ref_count.load(std::memory_order_acquire) == 0) {
+                free_node(node_);
+            } else {
+                retired_[n_pinned++] = node_;
+            }
+        }
+        retired_.resize(n_pinned);
+        draining_.store(false, std::memory_order_release);
+    }
+
+    // shared reclaim_mutex_, taken after a draining reclaimer if there is one
+    std::shared_lock<std::shared_mutex> read_gate() {
+        if (draining_.load(std::memory_order_acquire)) {
+            std::lock_guard wait(drain_mutex_);
+        }
+        return std::shared_lock(reclaim_mutex_);
+    }
+
+    void free_node(node *node_) {
+        n_deleted_node++;
+        delete node_;
+    }
+
+    // first live node after node_, TAIL_NODE if there is none
+    node *find_next(node *node_) {
+        if (node_ == TAIL_NODE) {
+            return TAIL_NODE;
+        }
+
+        node *next;
+        if (node_->kind == node::DATA && node_->marked.load(std::memory_order_acquire)) {
+            // next pointers of an unlinked node may be stale, search from the head instead
+            next = HEAD_NODE;
+            for (level_t level = MAX_LEVEL - 1; level >= 0; --level) {
+                node *curr = next->get_next(level);
+                while (curr != TAIL_NODE && !(node_->value < curr->value)) {
+                    next = curr;
+                    curr = next->get_next(level);
+                }
+            }
+            next = next->get_next(0);
+        } else {
+            next = node_->get_next(0);
+        }
+
+        while (next != TAIL_NODE && !next->is_alive()) {
+            next = next->get_next(0);
+        }
+        return next;
+    }
+
+    // last live node before node_, TAIL_NODE if there is none
+    node *find_prev(node *node_) {
+        while (true) {
+            node *pred = HEAD_NODE;
+            for (level_t level = MAX_LEVEL - 1; level >= 0; --level) {
+                node *curr = pred->get_next(level);
+                while (curr != TAIL_NODE && (node_ == TAIL_NODE || curr->value < node_->value)) {
+                    pred = curr;
+                    curr = pred->get_next(level);
+                }
+            }
+
+            if (pred == HEAD_NODE) {
+                return TAIL_NODE;
+            }
+            if (pred->is_alive()) {
+                return pred;
+            }
+            node_ = pred;
+        }
+    }
+
+    class iterator {
+    private:
+        consistent_skip_list *list = nullptr;
+        node *current_node = nullptr;
+
+        void acquire(node *node_) {
+            node_->ref_count.fetch_add(1, std::memory_order_acq_rel);
+            release();
+            current_node = node_;
+        }
+
+        // pins the neighbour under the gate, unpins the old node after dropping it
+        template<typename F>
+        void step(F find_neighbour) {
+            node *neighbour;
+            {
+                auto gate = list->read_gate();
+                neighbour = (list->*find_neighbour)(current_node);
+                neighbour->ref_count.fetch_add(1, std::memory_order_acq_rel);
+            }
+            release();
+            current_node = neighbour;
+        }
+
+        void release() {
+            if (current_node == nullptr) {
+                return;
+            }
+
+            // read before unpinning, the node may be freed right after
+            bool marked = current_node->marked.load(std::memory_order_acquire);
+            ref_count_t old = current_node->ref_count.fetch_sub(1, std::memory_order_acq_rel);
+            if (old == 1 && marked) {
+                list->try_reclaim();
+            }
+            current_node = nullptr;
+        }
+
+    public:
+        iterator() = default;
+
+        // the caller must hold list_->reclaim_mutex_ in shared mode
+        iterator(consistent_skip_list *list_, node *node_) : list(list_) {
+            acquire(node_);
+        }
+
+        iterator(const iterator &it) : list(it.list) {
+            if (it.current_node != nullptr) {
+                acquire(it.current_node);
+            }
+        }
+
+        iterator &operator=(const iterator &it) {
+            if (this != &it) {
+                list = it.list;
+                if (it.current_node != nullptr) {
+                    acquire(it.current_node);
+                } else {
+                    release();
+                }
+            }
+
+            return *this;
+        }
+
+        ~iterator() {
+            release();
+        }
+
+        value_node operator*() const {
+            return value_node(current_node);
+        }
+
+        iterator operator++() {
+            step(&consistent_skip_list::find_next);
+            return *this;
+        }
+
+        iterator operator--() {
+            step(&consistent_skip_list::find_prev);
+            return *this;
+        }
+
+        node *get_node() const {
+            return current_node;
+        }
+
+        bool operator==(const iterator &rhs) const {
+            return current_node == rhs.current_node;
+        }
+
+        bool operator!=(const iterator &rhs) const {
+            return current_node != rhs.current_node;
+        }
+    };
+};
@@ -3,17 +3,47 @@
 #include <thread>
 #include <mutex>
 #include <shared_mutex>
+#include <atomic>
+#include <functional>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
+#include <vector>
+#include <future>
+#include <optional>
+#include <exception>
+
+#include "thread_pool.h"
+#include "container_stats.h"
+#include "lock_profiler.h"
+#include "container_metrics.h"
+
+// asks for *p to be loaded into the cache ahead of use; a no-op where the builtin is missing
+#if defined(__GNUC__)
+#define CONSISTENT_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define CONSISTENT_PREFETCH(p)
+#endif
 
 struct receiver {
     int value = 0;
 };
 
-template<typename T>
+/*
+ * Compare is a strict weak ordering like std::less. With a transparent
+ * comparator (one that has is_transparent, e.g. std::less<>) find,
+ * lower_bound, rank and count_range also accept keys of other types.
+ */
+template<typename T, typename Compare = std::less<T>>
 class consistent_tree {
 public:
     using height_t = uint8_t;
     using value_t = T;
     using ref_count_t = uint32_t;
+    using compare_t = Compare;
+
+    template<typename K, typename C>
+    using if_transparent = std::enable_if_t<!std::is_same_v<K, value_t>, typename C::is_transparent>;
 
     class node;
 
@@ -21,25 +51,49 @@ public:
 
     class iterator;
 
+    class value_guard;
+
+    class read_guard;
+
     class node {
     private:
         value_t value;
         height_t height = 1;
+        // number of not deleted nodes in the subtree
+        size_t count = 1;
 
         node *left = nullptr;
         node *right = nullptr;
         node *parent = nullptr;
 
-        bool is_deleted_ = false;
-        ref_count_t ref_count = 0;
+        // in-order neighbours, deleted or not, a ring through HEAD_NODE; rotations don't touch them
+        node *next = this;
+        node *prev = this;
+
+        /*
+         * Iterator pins counted in steps of PIN, and two flags: DELETED only
+         * changes under the unique lock, PENDING marks a deleted node whose last
+         * pin went away and that waits in tree->pending_frees. Keeping them in
+         * one word lets exactly one thread see the node become free.
+         */
+        std::atomic<ref_count_t> ref_count{0};
+
+        static constexpr ref_count_t DELETED = 1;
+        static constexpr ref_count_t PENDING = 2;
+        static constexpr ref_count_t PIN = 4;
 
     public:
         consistent_tree *tree;
 
         node(consistent_tree *tree_, node *parent_, value_t value_) :
-                tree(tree_), value(value_), parent(parent_) {}
+                tree(tree_), value(std::move(value_)), parent(parent_) {}
+
+        const value_t &get_value() {
+            return value;
+        }
 
-        value_t get_value() {
+        // for in-place updates that keep the ordering, under tree->value_mutex(this)
+        value_t &get_mutable_value() {
             return value;
         }
 
@@ -47,6 +101,10 @@ public:
             value = value_;
         }
 
+        void set_value(value_t &&value_) {
+            value = std::move(value_);
+        }
+
 
         height_t get_height() {
             return height;
@@ -57,6 +115,15 @@ public:
         }
 
 
+        size_t get_count() {
+            return count;
+        }
+
+        void set_count(const size_t &count_) {
+            count = count_;
+        }
+
+
         node *get_left() {
             return left;
         }
@@ -90,40 +157,113 @@ public:
         }
 
 
+        node *get_next() {
+            return next;
+        }
+
+        node *get_prev() {
+            return prev;
+        }
+
+        // puts this node right before next_ in the in-order ring
+        void link_before(node *next_) {
+            link(next_->prev, this);
+            link(this, next_);
+        }
+
+        static void link(node *prev_, node *next_) {
+            prev_->next = next_;
+            next_->prev = prev_;
+        }
+
+        // live and not pinned, so it can be handed to another tree; under the unique lock
+        bool is_movable() {
+            return ref_count.load() == 0;
+        }
+
+        // a lone leaf of tree_, for a node moved between trees
+        void reset(consistent_tree *tree_) {
+            tree = tree_;
+            left = right = parent = nullptr;
+            next = prev = this;
+            height = 1;
+            count = 1;
+        }
+
+
+        /*
+         * n is 1 or -1. Pinning never frees. Iterators drop pins without the
+         * tree lock, so the last pin of a deleted node doesn't restructure the
+         * tree here but queues the node for whoever holds the unique lock.
+         */
         void add_ref_count(int n) {
             if (this == tree->HEAD_NODE) {
                 return;
             }
 
-            ref_count += n;
+            if (n > 0) {
+                ref_count_t before = ref_count.fetch_add(PIN);
+                tree->metrics_.on_pin(before / PIN, 1);
+                return;
+            }
 
-            if (need_free()) {
-                tree->finally_erase(value);
+            // once the pin is gone a writer may free the node, so nothing is read after it
+            consistent_tree *tree_ = tree;
+            ref_count_t before = ref_count.load();
+            ref_count_t after;
+            do {
+                after = before == (PIN | DELETED) ? (DELETED | PENDING) : before - PIN;
+            } while (!ref_count.compare_exchange_weak(before, after));
+
+            tree_->metrics_.on_pin(before / PIN, -1);
+            if (after == (DELETED | PENDING)) {
+                tree_->queue_free(this);
             }
         }
 
+        // under the unique lock
         void set_deleted(bool delete_flag) {
-            if (is_deleted_ && !delete_flag) {
-                tree->size_++;
-            } else if (!is_deleted_ && delete_flag) {
-                tree->size_--;
+            bool deleted = is_deleted();
+            if (deleted && !delete_flag) {
+                tree->size_.fetch_add(1, std::memory_order_relaxed);
+                live_metrics::add(tree->metrics_.tombstones, -1);
+                add_count_to_path(1);
+                ref_count.fetch_and(~DELETED);
+                tree->track_live(this);
+            } else if (!deleted && delete_flag) {
+                tree->size_.fetch_sub(1, std::memory_order_relaxed);
+                live_metrics::add(tree->metrics_.tombstones, 1);
+                add_count_to_path(-1);
+                ref_count.fetch_or(DELETED);
+                tree->untrack_live(this);
             }
 
-            is_deleted_ = delete_flag;
-
             if (need_free()) {
-                tree->finally_erase(value);
+                tree->finally_erase(this);
             }
         }
 
         bool is_deleted() {
-            return is_deleted_;
+            return ref_count.load(std::memory_order_relaxed) & DELETED;
+        }
+
+        // under the unique lock, before a queued node is looked at again
+        void clear_pending() {
+            ref_count.fetch_and(~PENDING);
+        }
+
+        void add_count_to_path(int n) {
+            for (node *node_ = this; node_ != tree->HEAD_NODE; node_ = node_->get_parent()) {
+                node_->count += n;
+            }
         }
 
 
         void free() {
             unlink();
             tree->n_deleted_node++;
+            live_metrics::add(tree->metrics_.tombstones, -1);
+            live_metrics::add(tree->metrics_.frees, 1);
 //            std::cout << "It's all, we deleted :( value = " << value << std::endl;
             delete this;
         }
@@ -143,71 +283,179 @@ public:
                 get_right()->set_parent(nullptr);
             }
 
-            left = right = parent = nullptr;
+            prev->next = next;
+            next->prev = prev;
+
+            left = right = parent = next = prev = nullptr;
         }
 
         bool need_free() {
-            return is_deleted_ && ref_count == 0;
+            return ref_count.load() == DELETED;
         }
     };
 
+    /*
+     * What *it gives. get() and set() lock the node's stripe of
+     * tree->value_mutexes, the same lock every in-place update of the value
+     * takes, so a copy never sees a half-written value.
+     */
     class value_node {
     private:
         node *current_node;
-        std::shared_mutex mutex_;
     public:
         explicit value_node(node *node_) : current_node(node_) {}
 
-        value_t get() {
-            std::shared_lock lock(mutex_);
+        value_t get() const {
+            std::shared_lock lock(current_node->tree->value_mutex(current_node));
+            return current_node->get_value();
+        }
+
+        // valid while an iterator pins the node, not synchronized with set()
+        const value_t &get_ref() const {
             return current_node->get_value();
         }
 
+        // value_ must keep the node's place in the ordering
         void set(const value_t &value_) {
-            std::unique_lock lock(mutex_);
+            std::unique_lock lock(current_node->tree->value_mutex(current_node));
             current_node->set_value(value_);
         }
+
+        // calls fn(value_t &) under the lock, fn must keep the ordering
+        template<typename F>
+        void update(F fn) {
+            std::unique_lock lock(current_node->tree->value_mutex(current_node));
+            fn(current_node->get_mutable_value());
+        }
+    };
+
+    /*
+     * Flat combining: a writer that can't take mutex_ publishes its operation
+     * into a slot and waits. Whoever holds the lock applies all published
+     * operations in one pass, so the lock isn't passed around between writers.
+     */
+    class alignas(64) combining_slot {
+    public:
+        enum state_t : uint8_t {
+            FREE, CLAIMED, PENDING, DONE
+        };
+
+        enum op_t : uint8_t {
+            INSERT, INSERT_MOVE, ERASE, ERASE_NODE
+        };
+
+        std::atomic<uint8_t> state{FREE};
+        op_t op = INSERT;
+        // only INSERT_MOVE moves from it, other operations treat it as const
+        value_t *value = nullptr;
+        // ERASE_NODE's node or the insert hint, pinned by the caller's iterator
+        node *node_ = nullptr;
+        // what apply() threw while combined by another thread, rethrown by the owner
+        std::exception_ptr error;
     };
 
+    static const size_t N_COMBINING_SLOTS = 32;
+
+    static const size_t N_VALUE_MUTEXES = 64;
+
 
     node *HEAD_NODE;
     uint32_t n_deleted_node = 0;
 
+    Compare comp;
+
     receiver *deleted_node_receiver = nullptr;
 
-    size_t size_ = 0;
+    live_metrics metrics_;
+
+    // only changed under mutex_, so writers never contend on it and
+    // size()/empty() can read it without taking the lock
+    std::atomic<size_t> size_{0};
+
+    // first and last live nodes, HEAD_NODE if there are none. Changed under
+    // mutex_ like the tree itself; rotations keep the in-order sequence, so
+    // only a node turning live or deleted moves them.
+    node *first_live;
+    node *last_live;
+#ifdef CONSISTENT_STATS
+    stats_recorder stats_;
+#endif
+#ifdef CONSISTENT_LOCK_PROFILING
+    lock_profile lock_profile_;
+#endif
+#if defined(CONSISTENT_LOCK_PROFILING) && defined(CONSISTENT_STATS)
+    profiled_mutex<stats_mutex<std::shared_mutex>> mutex_{&lock_profile_, &stats_};
+#elif defined(CONSISTENT_LOCK_PROFILING)
+    profiled_mutex<std::shared_mutex> mutex_{&lock_profile_};
+#elif defined(CONSISTENT_STATS)
+    stats_mutex<std::shared_mutex> mutex_{&stats_};
+#else
     std::shared_mutex mutex_;
+#endif
+
+    combining_slot combining_slots[N_COMBINING_SLOTS];
+    std::atomic<int> n_pending_ops{0};
+
+    // deleted nodes whose last pin was dropped without the unique lock, see free_pending()
+    std::mutex pending_frees_mutex;
+    std::vector<node *> pending_frees;
+    std::atomic<bool> has_pending_frees{false};
+
+    // striped locks for values changed in place, see value_mutex()
+    class alignas(64) value_mutex_stripe {
+    public:
+        std::shared_mutex mutex_;
+    };
+
+    value_mutex_stripe value_mutexes[N_VALUE_MUTEXES];
 
 
     consistent_tree() {
         HEAD_NODE = new node(this, nullptr, value_t());
         HEAD_NODE->set_parent(HEAD_NODE);
+        first_live = last_live = HEAD_NODE;
+    }
+
+    explicit consistent_tree(const Compare &comp_) : consistent_tree() {
+        comp = comp_;
     }
 
     explicit consistent_tree(receiver *receiver_) : consistent_tree() {
         deleted_node_receiver = receiver_;
     }
 
-    consistent_tree(const consistent_tree &tree_) {
+    consistent_tree(const consistent_tree &tree_) : comp(tree_.comp) {
         HEAD_NODE = new node(this, nullptr, value_t());
         HEAD_NODE->set_parent(HEAD_NODE);
+        first_live = last_live = HEAD_NODE;
 
         add_all(tree_.HEAD_NODE->get_right());
     }
 
+    // invalidates iterators of this tree, like the destructor
     consistent_tree &operator=(const consistent_tree &tree_) {
         if (this != &tree_) {
-            HEAD_NODE = new node(this, nullptr, value_t());
-            HEAD_NODE->set_parent(HEAD_NODE);
-            n_deleted_node = 0;
+            consistent_tree copy(tree_);
+
+            std::unique_lock lock(mutex_);
+            prepare_move();
+            node *old = HEAD_NODE->get_right();
+            node::link(HEAD_NODE, HEAD_NODE);
+            reset_root(nullptr);
+            cascade_delete_node(old);
 
-            add_all(tree_.HEAD_NODE->get_right());
+            comp = tree_.comp;
+            n_deleted_node = 0;
+            metrics_.reset();
+            absorb(copy, true);
         }
 
         return *this;
     }
 
     ~consistent_tree() {
+        // queued nodes are still in the tree
+        pending_frees.clear();
         cascade_delete_node(HEAD_NODE);
     }
 
@@ -240,311 +488,1533 @@ public:
 
 
     void insert(const value_t &value_) {
-        std::unique_lock lock(mutex_);
-        HEAD_NODE->set_right(insert(HEAD_NODE->get_right(), HEAD_NODE, value_));
+        static_assert(std::is_copy_constructible_v<value_t>, "inserting a copy needs a copyable value_t, move it in");
+        CONSISTENT_LOCK_SITE("insert");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::INSERT);
+        combine(combining_slot::INSERT, const_cast<value_t *>(&value_));
+    }
+
+    void insert(value_t &&value_) {
+        CONSISTENT_LOCK_SITE("insert");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::INSERT);
+        combine(combining_slot::INSERT_MOVE, &value_);
+    }
+
+    // hint is where value_ is expected to go right before, end() to append; a wrong hint costs a search
+    void insert(const iterator &hint, const value_t &value_) {
+        static_assert(std::is_copy_constructible_v<value_t>, "inserting a copy needs a copyable value_t, move it in");
+        CONSISTENT_LOCK_SITE("insert");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::INSERT);
+        combine(combining_slot::INSERT, const_cast<value_t *>(&value_), hint.get_node());
+    }
+
+    void insert(const iterator &hint, value_t &&value_) {
+        CONSISTENT_LOCK_SITE("insert");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::INSERT);
+        combine(combining_slot::INSERT_MOVE, &value_, hint.get_node());
+    }
+
+    template<typename... Args>
+    void emplace(Args &&... args) {
+        value_t value_(std::forward<Args>(args)...);
+        insert(std::move(value_));
     }
 
     void erase(const value_t &value_) {
-        std::unique_lock lock(mutex_);
-        try_remove(HEAD_NODE->get_right(), value_);
+        CONSISTENT_LOCK_SITE("erase");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::ERASE);
+        combine(combining_slot::ERASE, const_cast<value_t *>(&value_));
     }
 
+    // the iterator pins its node, so the node is erased directly, without a search
     void erase(const iterator &it) {
-        std::unique_lock lock(mutex_);
-        try_remove(HEAD_NODE->get_right(), (*it).get());
+        CONSISTENT_LOCK_SITE("erase");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::ERASE);
+        combine(combining_slot::ERASE_NODE, nullptr, it.get_node());
     }
 
     iterator find(const value_t &value_) {
-        std::shared_lock lock(mutex_);
-        return iterator(find(HEAD_NODE->get_right(), value_));
+        return find_<value_t>(value_);
     }
 
-    bool empty() {
-        std::shared_lock lock(mutex_);
-        return size_ == 0;
+    template<typename K, typename C = Compare, typename = if_transparent<K, C>>
+    iterator find(const K &key) {
+        return find_<K>(key);
     }
 
-    value_t front() {
-        std::shared_lock lock(mutex_);
-        node *res = find_min(HEAD_NODE->get_right());
-        if (res->is_deleted()) {
-            res = find_next(res);
-        }
-        return res->get_value();
+    /*
+     * Read-only queries: one shared lock and a descent, no iterator, so no
+     * node is pinned and no reference count is written.
+     */
+    bool contains(const value_t &value_) {
+        return contains_<value_t>(value_);
     }
 
-    value_t back() {
-        std::shared_lock lock(mutex_);
-        node *res = find_max(HEAD_NODE->get_right());
-        if (res->is_deleted()) {
-            res = find_prev(res);
-        }
-        return res->get_value();
+    template<typename K, typename C = Compare, typename = if_transparent<K, C>>
+    bool contains(const K &key) {
+        return contains_<K>(key);
     }
 
-    size_t size() {
-        std::shared_lock lock(mutex_);
-        return size_;
+    // 0 or 1, the elements are unique
+    size_t count(const value_t &value_) {
+        return contains_<value_t>(value_) ? 1 : 0;
     }
 
-    void clear() {
-        std::unique_lock lock(mutex_);
-        HEAD_NODE->set_right(nullptr);
+    template<typename K, typename C = Compare, typename = if_transparent<K, C>>
+    size_t count(const K &key) {
+        return contains_<K>(key) ? 1 : 0;
     }
 
+    // a copy of the equal element, taken under its value lock like value_node::get()
+    std::optional<value_t> try_get(const value_t &value_) {
+        return try_get_<value_t>(value_);
+    }
 
-    iterator begin() {
-        std::shared_lock lock(mutex_);
-        node *node_ = HEAD_NODE->get_right();
+    template<typename K, typename C = Compare, typename = if_transparent<K, C>>
+    std::optional<value_t> try_get(const K &key) {
+        return try_get_<K>(key);
+    }
 
-        if (node_ == nullptr) {
-            return iterator(HEAD_NODE);
-        }
+    // a copy of the first element that is not less than value_
+    std::optional<value_t> lower_bound_value(const value_t &value_) {
+        return lower_bound_value_<value_t>(value_);
+    }
 
-        node *min = find_min(node_);
-        return iterator(min->is_deleted() ? find_next(min) : min);
+    template<typename K, typename C = Compare, typename = if_transparent<K, C>>
+    std::optional<value_t> lower_bound_value(const K &key) {
+        return lower_bound_value_<K>(key);
     }
 
-    iterator end() {
+    /*
+     * find() for many keys under one shared lock. Up to BATCH_GROUP searches
+     * go down the tree together, one level per round, and each prefetches
+     * its next node, so their cache misses overlap instead of queueing.
+     */
+    std::vector<iterator> find_batch(const std::vector<value_t> &keys) {
+        CONSISTENT_LOCK_SITE("find_batch");
+        std::vector<iterator> res(keys.size());
         std::shared_lock lock(mutex_);
-        return iterator(HEAD_NODE);
+        find_batch_(keys, [&](size_t i, node *node_) {
+            res[i] = iterator(node_ == nullptr ? HEAD_NODE : node_);
+        });
+        return res;
     }
 
-
-    std::vector<value_t> to_vector() {
+    // find_batch() without pinning the found nodes
+    std::vector<bool> contains_batch(const std::vector<value_t> &keys) {
+        CONSISTENT_LOCK_SITE("find_batch");
+        std::vector<bool> res(keys.size());
         std::shared_lock lock(mutex_);
-        std::vector<value_t> v;
-        to_vector_(v, HEAD_NODE->get_right());
-        return v;
+        find_batch_(keys, [&](size_t i, node *node_) {
+            res[i] = node_ != nullptr;
+        });
+        return res;
     }
 
+    // first element that is not less than value_
+    iterator lower_bound(const value_t &value_) {
+        return lower_bound_<value_t>(value_);
+    }
 
-    void to_vector_(std::vector<value_t> &v, node *node_) {
-        if (node_ == nullptr) {
-            return;
-        }
-        to_vector_(v, node_->get_left());
+    template<typename K, typename C = Compare, typename = if_transparent<K, C>>
+    iterator lower_bound(const K &key) {
+        return lower_bound_<K>(key);
+    }
 
-        if (!node_->is_deleted()) {
-            v.push_back(node_->get_value());
-        }
+    // k-th (from 0) element in sorted order, end() if there are not enough elements
+    iterator nth(size_t k) {
+        CONSISTENT_LOCK_SITE("nth");
+        std::shared_lock lock(mutex_);
+        return iterator(nth_node(k));
+    }
 
-        to_vector_(v, node_->get_right());
+    // number of elements less than value_
+    size_t rank(const value_t &value_) {
+        CONSISTENT_LOCK_SITE("rank");
+        std::shared_lock lock(mutex_);
+        return rank_(value_);
     }
 
-    height_t get_height(node *node_) {
-        return node_ == nullptr ? 0 : node_->get_height();
+    template<typename K, typename C = Compare, typename = if_transparent<K, C>>
+    size_t rank(const K &key) {
+        CONSISTENT_LOCK_SITE("rank");
+        std::shared_lock lock(mutex_);
+        return rank_(key);
     }
 
-    int bfactor(node *node_) {
-        return get_height(node_->get_right()) - get_height(node_->get_left());
+    // number of elements in [lo, hi)
+    size_t count_range(const value_t &lo, const value_t &hi) {
+        return count_range_<value_t>(lo, hi);
     }
 
-    void fix_height(node *node_) {
-        height_t lh = get_height(node_->get_left());
-        height_t rh = get_height(node_->get_right());
+    template<typename K, typename C = Compare, typename = if_transparent<K, C>>
+    size_t count_range(const K &lo, const K &hi) {
+        return count_range_<K>(lo, hi);
+    }
 
-        height_t max_h = lh > rh ? lh : rh;
-        node_->set_height(max_h + 1);
+    bool empty() {
+        return size_.load(std::memory_order_relaxed) == 0;
     }
 
-    static void acquire(node **dest, node *from) {
-        if (dest != nullptr && *dest != nullptr) {
-            (*dest)->add_ref_count(-1);
-        }
-        *dest = from;
-        if (from != nullptr) {
-            (*dest)->add_ref_count(1);
+    // a copy of the smallest value, std::nullopt for an empty tree
+    std::optional<value_t> front() {
+        CONSISTENT_LOCK_SITE("front");
+        std::shared_lock lock(mutex_);
+        if (size_ == 0) {
+            return std::nullopt;
         }
+        std::shared_lock value_lock(value_mutex(first_live));
+        return first_live->get_value();
     }
 
-    node *rotate_right(node *p) {
-        node *q = p->get_left();
-        p->set_left(q->get_right());
-        q->set_right(p);
+    std::optional<value_t> back() {
+        CONSISTENT_LOCK_SITE("back");
+        std::shared_lock lock(mutex_);
+        if (size_ == 0) {
+            return std::nullopt;
+        }
+        std::shared_lock value_lock(value_mutex(last_live));
+        return last_live->get_value();
+    }
 
-        fix_height(p);
-        fix_height(q);
+    // front() and back() without copying, an empty guard for an empty tree
+    value_guard front_guard() {
+        CONSISTENT_LOCK_SITE("front");
+        std::shared_lock lock(mutex_);
+        if (size_ == 0) {
+            return value_guard();
+        }
+        return value_guard(first_live);
+    }
 
-        return q;
+    value_guard back_guard() {
+        CONSISTENT_LOCK_SITE("back");
+        std::shared_lock lock(mutex_);
+        if (size_ == 0) {
+            return value_guard();
+        }
+        return value_guard(last_live);
     }
 
-    node *rotate_left(node *q) {
-        node *p = q->get_right();
-        q->set_right(p->get_left());
-        p->set_left(q);
+    // latency histograms, empty unless built with CONSISTENT_STATS
+    container_stats stats() {
+#ifdef CONSISTENT_STATS
+        return stats_.snapshot();
+#else
+        return container_stats();
+#endif
+    }
 
-        fix_height(q);
-        fix_height(p);
+    // lock contention per call site, empty unless built with CONSISTENT_LOCK_PROFILING
+    lock_stats_snapshot lock_stats() {
+#ifdef CONSISTENT_LOCK_PROFILING
+        return lock_profile_.snapshot();
+#else
+        return lock_stats_snapshot();
+#endif
+    }
 
-        return p;
+    // tombstones, pinned nodes, frees and rebalancing, readable at any time without locking
+    container_metrics metrics() const {
+        return metrics_.snapshot();
     }
 
-    node *balance(node *p) {
-        fix_height(p);
+    size_t size() {
+        return size_.load(std::memory_order_relaxed);
+    }
 
-        if (bfactor(p) == 2) {
-            if (bfactor(p->get_right()) < 0) {
-                node *res = rotate_right(p->get_right());
-                p->set_right(res);
-            }
-            return rotate_left(p);
+    // pinned nodes stay in the tree as deleted until their iterators let go
+    void clear() {
+        CONSISTENT_LOCK_SITE("clear");
+        std::unique_lock lock(mutex_);
+        std::vector<node *> nodes;
+        nodes.reserve(size_.load(std::memory_order_relaxed));
+        for (node *node_ = first_node(); node_ != HEAD_NODE; node_ = find_next(node_)) {
+            nodes.push_back(node_);
         }
-        if (bfactor(p) == -2) {
-            if (bfactor(p->get_left()) > 0) {
-                node *res = rotate_left(p->get_left());
-                p->set_left(res);
-            }
-            return rotate_right(p);
+        for (node *node_: nodes) {
+            node_->set_deleted(true);
         }
-        return p;
+        free_pending();
     }
 
+    /*
+     * Moves every element not less than key into greater, which must be
+     * empty. O(log n) comparisons and rotations plus one pass over the moved
+     * nodes; false, with neither tree changed, if an iterator pins one of them.
+     */
+    bool split(const value_t &key, consistent_tree &greater) {
+        return split_<value_t>(key, greater);
+    }
 
-    node *insert(node *node_, node *parent, const value_t &value_) {
-        if (node_ == nullptr) {
-            size_++;
-            return new node(this, parent, value_);
-        }
-        if (value_ < node_->get_value()) {
-            node_->set_left(insert(node_->get_left(), node_, value_));
-        } else if (value_ > node_->get_value()) {
-            node_->set_right(insert(node_->get_right(), node_, value_));
-        } else {
-            node_->set_deleted(false);
-            return node_;
-        }
-
-        return balance(node_);
+    template<typename K, typename C = Compare, typename = if_transparent<K, C>>
+    bool split(const K &key, consistent_tree &greater) {
+        return split_<K>(key, greater);
     }
 
-    node *remove_min(node *p) {
-        if (p->get_left() == nullptr)
-            return p->get_right();
+    // moves all of greater, whose elements must all be greater than ours, to the end of this tree
+    bool join(consistent_tree &greater) {
+        CONSISTENT_LOCK_SITE("join");
+        if (&greater == this) {
+            return false;
+        }
+        std::scoped_lock lock(mutex_, greater.mutex_);
+        prepare_move();
+        greater.prepare_move();
+        if (!greater.is_movable() || !is_before(greater)) {
+            return false;
+        }
 
-        p->set_left(remove_min(p->get_left()));
-        return balance(p);
+        absorb(greater, true);
+        return true;
     }
 
-    void try_remove(node *node_, const value_t &value_) {
-        if (node_ == nullptr) {
-            return;
+    /*
+     * Moves other's nodes into this tree without copying values. Disjoint
+     * ranges are joined as in join(), interleaved ones node by node with one
+     * search each. Keys already here, even as erased nodes, stay in other,
+     * as with std::set::merge. False if an iterator pins a node of other.
+     */
+    bool merge(consistent_tree &other) {
+        CONSISTENT_LOCK_SITE("merge");
+        if (&other == this) {
+            return false;
         }
-
-        if (node_->get_value() == value_) {
-            node_->set_deleted(true);
-            return;
+        std::scoped_lock lock(mutex_, other.mutex_);
+        prepare_move();
+        other.prepare_move();
+        if (!other.is_movable()) {
+            return false;
         }
 
-        if (value_ < node_->get_value()) {
-            try_remove(node_->get_left(), value_);
+        if (is_before(other)) {
+            absorb(other, true);
+        } else if (other.is_before(*this)) {
+            absorb(other, false);
         } else {
-            try_remove(node_->get_right(), value_);
+            merge_nodes(other);
         }
+        return true;
     }
 
-    void finally_erase(const value_t &value_) {
-        node *res = finally_erase_(HEAD_NODE->get_right(), value_);
-        HEAD_NODE->set_right(res);
+    /*
+     * Set algebra into out, which must be empty and must not be an input;
+     * false otherwise. The inputs are only read and stay unchanged. Walks
+     * both inputs in order, and a side that keeps falling behind jumps ahead
+     * with a search from the root. With par(pool) the key space is cut into
+     * ranges of the larger input, each range is built into a subtree by a
+     * worker and the subtrees are joined.
+     *
+     * The result is always copied, so the cost is at least its size. An
+     * intersection, or this minus a larger other, costs O(m log n) for a small
+     * side of m elements. A union copies both inputs and a large tree minus a
+     * small one copies the large side: O(n + m) whatever the sizes; use
+     * merge() to move the nodes instead when the inputs may be consumed.
+     * Similar sizes cost O(n + m) too, which is still several times faster
+     * than to_vector(), a std:: set algorithm and inserting the result into a
+     * tree, since the result is built balanced without searches.
+     */
+    template<typename Policy>
+    bool set_union(Policy policy, consistent_tree &other, consistent_tree &out) {
+        CONSISTENT_LOCK_SITE("set_union");
+        return set_algebra_(policy, set_op::UNION, other, out);
     }
 
-    node *finally_erase_(node *node_, const value_t &value_) {
-        if (node_ == nullptr) {
-            return nullptr;
-        }
-
-        if (value_ < node_->get_value()) {
-            node_->set_left(finally_erase_(node_->get_left(), value_));
-        } else if (value_ > node_->get_value()) {
-            node_->set_right(finally_erase_(node_->get_right(), value_));
-        } else {
-            node *left = node_->get_left();
-            node *right = node_->get_right();
+    bool set_union(consistent_tree &other, consistent_tree &out) {
+        return set_union(consistent_execution::seq, other, out);
+    }
 
-            node_->free();
+    template<typename Policy>
+    bool set_intersection(Policy policy, consistent_tree &other, consistent_tree &out) {
+        CONSISTENT_LOCK_SITE("set_intersection");
+        return set_algebra_(policy, set_op::INTERSECTION, other, out);
+    }
 
-            if (right == nullptr) {
-                return left;
-            }
+    bool set_intersection(consistent_tree &other, consistent_tree &out) {
+        return set_intersection(consistent_execution::seq, other, out);
+    }
 
-            node *min = find_min(right);
-            min->set_right(remove_min(right));
-            min->set_left(left);
+    // elements of this tree that are not in other
+    template<typename Policy>
+    bool set_difference(Policy policy, consistent_tree &other, consistent_tree &out) {
+        CONSISTENT_LOCK_SITE("set_difference");
+        return set_algebra_(policy, set_op::DIFFERENCE, other, out);
+    }
 
-            return balance(min);
-        }
-        return balance(node_);
+    bool set_difference(consistent_tree &other, consistent_tree &out) {
+        return set_difference(consistent_execution::seq, other, out);
     }
 
-    node *find(node *node_, const value_t &value_) {
-        if (node_ == nullptr) {
-            return HEAD_NODE;
-        }
-        if (node_->get_value() < value_) {
-            return find(node_->get_right(), value_);
-        } else if (node_->get_value() > value_) {
-            return find(node_->get_left(), value_);
-        }
 
-        return node_->is_deleted() ? HEAD_NODE : node_;
+    iterator begin() {
+        CONSISTENT_LOCK_SITE("begin");
+        std::shared_lock lock(mutex_);
+        return iterator(first_node());
     }
 
-    static node *find_min(node *node_) {
-        return node_->get_left() == nullptr ? node_ : find_min(node_->get_left());
+    iterator end() {
+        CONSISTENT_LOCK_SITE("end");
+        std::shared_lock lock(mutex_);
+        return iterator(HEAD_NODE);
     }
 
-    static node *find_max(node *node_) {
-        return node_->get_right() == nullptr ? node_ : find_max(node_->get_right());
+    // locks the tree for reading until the guard is destroyed, see read_guard
+    read_guard read() {
+        CONSISTENT_LOCK_SITE("read");
+        return read_guard(this);
     }
 
-    static node *find_next(node *node_) {
-        if (node_ == node_->get_parent()) {
-            return node_;
-        }
-        value_t value = node_->get_value();
 
-        node *right = node_->get_right();
-        if (right != nullptr) {
-            auto res = find_min(right);
-            return res->is_deleted() ? find_next(res) : res;
-        }
+    std::vector<value_t> to_vector() {
+        CONSISTENT_LOCK_SITE("to_vector");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::TO_VECTOR);
+        std::shared_lock lock(mutex_);
+        std::vector<value_t> v;
+        v.reserve(size_.load(std::memory_order_relaxed));
+        to_vector_(v, HEAD_NODE->get_right());
+        return v;
+    }
+
+    // same as to_vector(), but subtrees are copied by the pool's workers
+    // straight into their final positions
+    std::vector<value_t> to_vector(thread_pool &pool) {
+        CONSISTENT_LOCK_SITE("to_vector");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::TO_VECTOR);
+        std::shared_lock lock(mutex_);
+        // the live count of the root is size_, and it can't change while the lock is held
+        std::vector<value_t> v(get_count(HEAD_NODE->get_right()));
 
-        auto parent = node_->get_parent();
-        while (parent->get_value() < value && parent != parent->get_parent()) {
-            parent = parent->get_parent();
+        auto parts = split_(pool);
+        std::vector<size_t> offsets(parts.size() + 1, 0);
+        for (size_t i = 0; i < parts.size(); ++i) {
+            offsets[i + 1] = offsets[i] + parts[i].size();
         }
 
-        return parent->is_deleted() ? find_next(parent) : parent;
+        run_parts_(pool, parts, [&v, &offsets](size_t i, const part &part_) {
+            value_t *out = v.data() + offsets[i];
+            visit_part(part_, [&out](const value_t &value_) { *out++ = value_; });
+        });
+        return v;
     }
 
-    static node *find_prev(node *node_) {
-        if (node_ == node_->get_parent()) {
-            if (node_->tree->size_ == 0) {
-                return node_;
-            }
-            node *res = find_max(node_->tree->HEAD_NODE->get_right());
-            return res->is_deleted() ? find_prev(res) : res;
-        }
-        value_t value = node_->get_value();
+    /*
+     * Bulk algorithms. fn, pred and transform get the live values in order
+     * (in any order and concurrently with par) under the shared lock, so they
+     * must not change the tree. reduce must be associative.
+     */
+    template<typename F>
+    void for_each(F fn) {
+        for_each(consistent_execution::seq, fn);
+    }
 
-        node *left = node_->get_left();
-        if (left != nullptr) {
-            auto res = find_max(left);
-            return res->is_deleted() ? find_prev(res) : res;
-        }
+    template<typename F>
+    void for_each(consistent_execution::sequenced_policy, F fn) {
+        CONSISTENT_LOCK_SITE("for_each");
+        std::shared_lock lock(mutex_);
+        visit_subtree(HEAD_NODE->get_right(), fn);
+    }
 
-        auto parent = node_->get_parent();
-        while (parent->get_value() > value && parent != parent->get_parent()) {
-            parent = parent->get_parent();
-        }
+    template<typename F>
+    void for_each(consistent_execution::parallel_policy policy, F fn) {
+        CONSISTENT_LOCK_SITE("for_each");
+        std::shared_lock lock(mutex_);
+        run_parts_(policy.pool, split_(policy.pool), [&fn](size_t, const part &part_) {
+            visit_part(part_, fn);
+        });
+    }
 
-        return parent->is_deleted() ? find_prev(parent) : parent;
+    template<typename R, typename Reduce, typename Transform>
+    R transform_reduce(consistent_execution::sequenced_policy, R init, Reduce reduce, Transform transform) {
+        CONSISTENT_LOCK_SITE("reduce");
+        std::shared_lock lock(mutex_);
+        visit_subtree(HEAD_NODE->get_right(), [&](const value_t &value_) {
+            init = reduce(std::move(init), transform(value_));
+        });
+        return init;
     }
 
-    class iterator {
-    private:
-        node *current_node = nullptr;
-    public:
+    template<typename R, typename Reduce, typename Transform>
+    R transform_reduce(consistent_execution::parallel_policy policy, R init, Reduce reduce, Transform transform) {
+        CONSISTENT_LOCK_SITE("reduce");
+        std::shared_lock lock(mutex_);
+        auto parts = split_(policy.pool);
+        std::vector<std::optional<R>> results(parts.size());
+        run_parts_(policy.pool, parts, [&](size_t i, const part &part_) {
+            std::optional<R> res;
+            visit_part(part_, [&](const value_t &value_) {
+                res = res ? reduce(std::move(*res), transform(value_)) : R(transform(value_));
+            });
+            results[i] = std::move(res);
+        });
+
+        for (auto &res: results) {
+            if (res) {
+                init = reduce(std::move(init), std::move(*res));
+            }
+        }
+        return init;
+    }
+
+    template<typename Policy, typename P>
+    size_t count_if(Policy policy, P pred) {
+        return transform_reduce(policy, size_t(0), std::plus<>(), [&pred](const value_t &value_) -> size_t {
+            return pred(value_) ? 1 : 0;
+        });
+    }
+
+    template<typename P>
+    size_t count_if(P pred) {
+        return count_if(consistent_execution::seq, pred);
+    }
+
+    // calls fn(const std::vector<value_t> &) for consecutive chunks of at most
+    // chunk_size values. The lock is released between chunks and the next chunk
+    // starts after the last value of the previous one, so writers are held off
+    // for one chunk only; every chunk is consistent, the whole sequence is not.
+    template<typename F>
+    void to_vector_chunked(size_t chunk_size, F fn) {
+        CONSISTENT_LOCK_SITE("to_vector");
+        if (chunk_size == 0) {
+            return;
+        }
+
+        std::vector<value_t> chunk;
+        chunk.reserve(chunk_size);
+        do {
+            {
+                std::shared_lock lock(mutex_);
+                node *node_ = chunk.empty() ? first_node() : upper_bound_node(chunk.back());
+                chunk.clear();
+                for (; node_ != HEAD_NODE && chunk.size() < chunk_size; node_ = find_next(node_)) {
+                    chunk.push_back(node_->get_value());
+                }
+            }
+
+            if (chunk.empty()) {
+                return;
+            }
+            fn(static_cast<const std::vector<value_t> &>(chunk));
+        } while (chunk.size() == chunk_size);
+    }
+
+
+    static constexpr size_t MIN_PARALLEL_TASK_SIZE = 1 << 12;
+
+    // a piece of the tree for the parallel algorithms: a whole subtree or a single node
+    class part {
+    public:
+        node *node_;
+        bool whole_subtree;
+
+        size_t size() const {
+            return whole_subtree ? get_count(node_) : !node_->is_deleted();
+        }
+    };
+
+    // in-order parts, a few per worker, so one deep subtree doesn't keep the others waiting
+    std::vector<part> split_(thread_pool &pool) {
+        node *root = HEAD_NODE->get_right();
+        size_t task_size = std::max(get_count(root) / (4 * pool.size()), MIN_PARALLEL_TASK_SIZE);
+        std::vector<part> parts;
+        split_(root, task_size, parts);
+        return parts;
+    }
+
+    void split_(node *node_, size_t task_size, std::vector<part> &parts) {
+        if (node_ == nullptr) {
+            return;
+        }
+
+        if (get_count(node_) <= task_size) {
+            parts.push_back({node_, true});
+            return;
+        }
+
+        split_(node_->get_left(), task_size, parts);
+        parts.push_back({node_, false});
+        split_(node_->get_right(), task_size, parts);
+    }
+
+    // calls fn(i, parts[i]) for every part on the pool and waits for all of them
+    template<typename F>
+    void run_parts_(thread_pool &pool, const std::vector<part> &parts, F fn) {
+        std::vector<std::future<void>> tasks;
+        tasks.reserve(parts.size());
+        for (size_t i = 0; i < parts.size(); ++i) {
+            if (parts[i].whole_subtree) {
+                tasks.push_back(pool.submit([&fn, &parts, i] { fn(i, parts[i]); }));
+            } else {
+                fn(i, parts[i]);
+            }
+        }
+        for (auto &task: tasks) {
+            pool.wait(task);
+        }
+    }
+
+    template<typename F>
+    static void visit_part(const part &part_, F &&fn) {
+        if (part_.whole_subtree) {
+            visit_subtree(part_.node_, fn);
+        } else if (!part_.node_->is_deleted()) {
+            fn(part_.node_->get_value());
+        }
+    }
+
+    template<typename F>
+    static void visit_subtree(node *node_, F &&fn) {
+        if (node_ == nullptr) {
+            return;
+        }
+        visit_subtree(node_->get_left(), fn);
+
+        if (!node_->is_deleted()) {
+            fn(node_->get_value());
+        }
+
+        visit_subtree(node_->get_right(), fn);
+    }
+
+    void to_vector_(std::vector<value_t> &v, node *node_) {
+        if (node_ == nullptr) {
+            return;
+        }
+        to_vector_(v, node_->get_left());
+
+        if (!node_->is_deleted()) {
+            v.push_back(node_->get_value());
+        }
+
+        to_vector_(v, node_->get_right());
+    }
+
+    void apply(typename combining_slot::op_t op, value_t *value_, node *node_) {
+        if (op == combining_slot::INSERT) {
+            // only the copying insert()s publish INSERT, and they don't compile for a move-only value_t
+            if constexpr (std::is_copy_constructible_v<value_t>) {
+                insert_(*const_cast<const value_t *>(value_), node_);
+            }
+        } else if (op == combining_slot::INSERT_MOVE) {
+            insert_(std::move(*value_), node_);
+        } else if (op == combining_slot::ERASE) {
+            try_remove(*value_);
+        } else if (node_ != HEAD_NODE) {
+            node_->set_deleted(true);
+        }
+    }
+
+    // must be called with mutex_ held
+    void apply_pending() {
+        if (n_pending_ops.load(std::memory_order_acquire) <= 0) {
+            return;
+        }
+
+        for (auto &slot: combining_slots) {
+            if (slot.state.load(std::memory_order_acquire) == combining_slot::PENDING) {
+                try {
+                    apply(slot.op, slot.value, slot.node_);
+                } catch (...) {
+                    slot.error = std::current_exception();
+                }
+                slot.state.store(combining_slot::DONE, std::memory_order_release);
+                n_pending_ops.fetch_sub(1, std::memory_order_acq_rel);
+            }
+        }
+    }
+
+    combining_slot &claim_slot() {
+        thread_local const size_t home = std::hash<std::thread::id>()(std::this_thread::get_id());
+
+        for (size_t i = 0;; ++i) {
+            auto &slot = combining_slots[(home + i) % N_COMBINING_SLOTS];
+            uint8_t expected = combining_slot::FREE;
+            if (slot.state.compare_exchange_weak(expected, combining_slot::CLAIMED,
+                                                 std::memory_order_acquire)) {
+                return slot;
+            }
+            if (i % N_COMBINING_SLOTS == N_COMBINING_SLOTS - 1) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void combine(typename combining_slot::op_t op, value_t *value_, node *node_ = nullptr) {
+        if (std::unique_lock lock(mutex_, std::try_to_lock); lock.owns_lock()) {
+            apply(op, value_, node_);
+            apply_pending();
+            free_pending();
+            return;
+        }
+
+        combining_slot &slot = claim_slot();
+        slot.op = op;
+        slot.value = value_;
+        slot.node_ = node_;
+        slot.state.store(combining_slot::PENDING, std::memory_order_release);
+        n_pending_ops.fetch_add(1, std::memory_order_acq_rel);
+
+        while (true) {
+            if (slot.state.load(std::memory_order_acquire) == combining_slot::DONE) {
+                break;
+            }
+            if (std::unique_lock lock(mutex_, std::try_to_lock); lock.owns_lock()) {
+                apply_pending();
+                free_pending();
+                break;
+            }
+            std::this_thread::yield();
+        }
+
+        std::exception_ptr error = std::move(slot.error);
+        slot.error = nullptr;
+        slot.state.store(combining_slot::FREE, std::memory_order_release);
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    /*
+     * Runs fn() under the unique lock for writes that don't fit a combining
+     * slot, then serves the slots and frees published meanwhile, as
+     * combine() does.
+     */
+    template<typename F>
+    auto with_unique_lock(F fn) {
+        std::unique_lock lock(mutex_);
+        if constexpr (std::is_void_v<decltype(fn())>) {
+            fn();
+            apply_pending();
+            free_pending();
+        } else {
+            auto res = fn();
+            apply_pending();
+            free_pending();
+            return res;
+        }
+    }
+
+
+    // guards in-place changes of node_'s value that don't touch the tree structure
+    std::shared_mutex &value_mutex(node *node_) {
+        return value_mutexes[reinterpret_cast<uintptr_t>(node_) / sizeof(node) % N_VALUE_MUTEXES].mutex_;
+    }
+
+    height_t get_height(node *node_) {
+        return node_ == nullptr ? 0 : node_->get_height();
+    }
+
+    static size_t get_count(node *node_) {
+        return node_ == nullptr ? 0 : node_->get_count();
+    }
+
+    // first live node, HEAD_NODE if there is none
+    node *first_node() {
+        return first_live;
+    }
+
+    // node_ has just become live, by insertion or by an erase being undone
+    void track_live(node *node_) {
+        if (first_live == HEAD_NODE || comp(node_->get_value(), first_live->get_value())) {
+            first_live = node_;
+        }
+        if (last_live == HEAD_NODE || comp(last_live->get_value(), node_->get_value())) {
+            last_live = node_;
+        }
+    }
+
+    // node_ has just been marked deleted and is still linked, so its live neighbours can be found
+    void untrack_live(node *node_) {
+        if (node_ == first_live) {
+            first_live = find_next(node_);
+        }
+        if (node_ == last_live) {
+            last_live = find_prev(node_);
+        }
+    }
+
+    // first live node greater than value_, HEAD_NODE if there is none
+    node *upper_bound_node(const value_t &value_) {
+        node *res = HEAD_NODE;
+        node *node_ = HEAD_NODE->get_right();
+        while (node_ != nullptr) {
+            if (comp(value_, node_->get_value())) {
+                res = node_;
+                node_ = node_->get_left();
+            } else {
+                node_ = node_->get_right();
+            }
+        }
+
+        return res->is_deleted() ? find_next(res) : res;
+    }
+
+    template<typename K>
+    iterator find_(const K &key) {
+        CONSISTENT_LOCK_SITE("find");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::FIND);
+        std::shared_lock lock(mutex_);
+        node *res = find_node(key);
+        return iterator(res == nullptr || res->is_deleted() ? HEAD_NODE : res);
+    }
+
+    template<typename K>
+    bool contains_(const K &key) {
+        CONSISTENT_LOCK_SITE("find");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::FIND);
+        std::shared_lock lock(mutex_);
+        node *res = find_node(key);
+        return res != nullptr && !res->is_deleted();
+    }
+
+    template<typename K>
+    std::optional<value_t> try_get_(const K &key) {
+        CONSISTENT_LOCK_SITE("find");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::FIND);
+        std::shared_lock lock(mutex_);
+        node *res = find_node(key);
+        if (res == nullptr || res->is_deleted()) {
+            return std::nullopt;
+        }
+        std::shared_lock value_lock(value_mutex(res));
+        return res->get_value();
+    }
+
+    template<typename K>
+    std::optional<value_t> lower_bound_value_(const K &key) {
+        CONSISTENT_LOCK_SITE("lower_bound");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::FIND);
+        std::shared_lock lock(mutex_);
+        node *res = lower_bound_node(key);
+        if (res == HEAD_NODE) {
+            return std::nullopt;
+        }
+        std::shared_lock value_lock(value_mutex(res));
+        return res->get_value();
+    }
+
+    template<typename K>
+    iterator lower_bound_(const K &key) {
+        CONSISTENT_LOCK_SITE("lower_bound");
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::FIND);
+        std::shared_lock lock(mutex_);
+        return iterator(lower_bound_node(key));
+    }
+
+    // first live node not less than key, HEAD_NODE if there is none
+    template<typename K>
+    node *lower_bound_node(const K &key) {
+        node *res = HEAD_NODE;
+        node *node_ = HEAD_NODE->get_right();
+        while (node_ != nullptr) {
+            if (comp(node_->get_value(), key)) {
+                node_ = node_->get_right();
+            } else {
+                res = node_;
+                node_ = node_->get_left();
+            }
+        }
+
+        return res->is_deleted() ? find_next(res) : res;
+    }
+
+    template<typename K>
+    size_t count_range_(const K &lo, const K &hi) {
+        CONSISTENT_LOCK_SITE("count_range");
+        std::shared_lock lock(mutex_);
+        if (!comp(lo, hi)) {
+            return 0;
+        }
+        return rank_(hi) - rank_(lo);
+    }
+
+    template<typename K>
+    size_t rank_(const K &key) {
+        size_t res = 0;
+        node *node_ = HEAD_NODE->get_right();
+        while (node_ != nullptr) {
+            if (comp(node_->get_value(), key)) {
+                res += get_count(node_->get_left()) + (node_->is_deleted() ? 0 : 1);
+                node_ = node_->get_right();
+            } else {
+                node_ = node_->get_left();
+            }
+        }
+        return res;
+    }
+
+    int bfactor(node *node_) {
+        return get_height(node_->get_right()) - get_height(node_->get_left());
+    }
+
+    void fix_height(node *node_) {
+        height_t lh = get_height(node_->get_left());
+        height_t rh = get_height(node_->get_right());
+
+        height_t max_h = lh > rh ? lh : rh;
+        node_->set_height(max_h + 1);
+
+        node_->set_count(get_count(node_->get_left()) + get_count(node_->get_right()) +
+                         (node_->is_deleted() ? 0 : 1));
+    }
+
+    // pins from before releasing *dest, so moving to the same node can't free it
+    static void acquire(node **dest, node *from) {
+        if (from != nullptr) {
+            from->add_ref_count(1);
+        }
+        if (dest != nullptr && *dest != nullptr) {
+            (*dest)->add_ref_count(-1);
+        }
+        *dest = from;
+    }
+
+    node *rotate_right(node *p) {
+        node *q = p->get_left();
+        p->set_left(q->get_right());
+        q->set_right(p);
+
+        fix_height(p);
+        fix_height(q);
+        live_metrics::add(metrics_.rotations, 1);
+
+        return q;
+    }
+
+    node *rotate_left(node *q) {
+        node *p = q->get_right();
+        q->set_right(p->get_left());
+        p->set_left(q);
+
+        fix_height(q);
+        fix_height(p);
+        live_metrics::add(metrics_.rotations, 1);
+
+        return p;
+    }
+
+    node *balance(node *p) {
+        fix_height(p);
+
+        if (bfactor(p) == 2) {
+            if (bfactor(p->get_right()) < 0) {
+                node *res = rotate_right(p->get_right());
+                p->set_right(res);
+            }
+            live_metrics::add(metrics_.rebalances, 1);
+            return rotate_left(p);
+        }
+        if (bfactor(p) == -2) {
+            if (bfactor(p->get_left()) > 0) {
+                node *res = rotate_left(p->get_left());
+                p->set_left(res);
+            }
+            live_metrics::add(metrics_.rebalances, 1);
+            return rotate_right(p);
+        }
+        return p;
+    }
+
+
+    /*
+     * V is const value_t & or value_t, only the inserted node consumes the value.
+     * hint is the node value_ is expected to go right before, nullptr for the
+     * end, so keys above the current maximum skip the search. If value_ doesn't
+     * fit there, it is searched for from the root. Returns the node holding
+     * the key: the new one, a revived tombstone or the live one already there.
+     */
+    template<typename V>
+    node *insert_(V &&value_, node *hint = nullptr) {
+        node *next_ = hint == nullptr ? HEAD_NODE : hint;
+        if (!fits_before(next_, value_)) {
+            next_ = lower_bound_any(value_);
+            if (next_ != HEAD_NODE && !comp(value_, next_->get_value())) {
+                if (next_->is_deleted()) {
+                    // equal by ordering, but the rest of the value may differ
+                    std::unique_lock value_lock(value_mutex(next_));
+                    next_->set_value(std::forward<V>(value_));
+                    next_->set_deleted(false);
+                }
+                return next_;
+            }
+        }
+        return insert_before(next_, std::forward<V>(value_));
+    }
+
+    // value_ goes strictly between next_'s in-order predecessor and next_, deleted or not
+    bool fits_before(node *next_, const value_t &value_) {
+        node *prev_ = next_->get_prev();
+        return (next_ == HEAD_NODE || comp(value_, next_->get_value())) &&
+               (prev_ == HEAD_NODE || comp(prev_->get_value(), value_));
+    }
+
+    /*
+     * Adds value_ as a leaf right before next_, see fits_before(). The leaf
+     * goes under next_ if it has no left subtree, otherwise under the
+     * predecessor, which then has no right one. Counts change up to the root,
+     * but rebalancing stops at the first subtree whose height is unchanged.
+     */
+    template<typename V>
+    node *insert_before(node *next_, V &&value_) {
+        node *res = new node(this, nullptr, std::forward<V>(value_));
+        link_leaf(res, next_);
+        return res;
+    }
+
+    // insert_before() for a live node of this tree that isn't linked anywhere yet
+    void link_leaf(node *res, node *next_) {
+        bool is_left = next_ != HEAD_NODE && next_->get_left() == nullptr;
+        node *parent = is_left ? next_ : next_->get_prev();
+
+        size_.fetch_add(1, std::memory_order_relaxed);
+        res->link_before(next_);
+        is_left ? parent->set_left(res) : parent->set_right(res);
+        track_live(res);
+
+        parent->add_count_to_path(1);
+        rebalance_up(parent);
+        metrics_.set_height(get_height(HEAD_NODE->get_right()));
+    }
+
+    node *remove_min(node *p) {
+        if (p->get_left() == nullptr)
+            return p->get_right();
+
+        p->set_left(remove_min(p->get_left()));
+        return balance(p);
+    }
+
+    template<typename K>
+    void try_remove(const K &key) {
+        node *node_ = find_node(key);
+        if (node_ != nullptr) {
+            node_->set_deleted(true);
+        }
+    }
+
+    // frees the queued node now if the tree isn't locked, otherwise the next writer does
+    void queue_free(node *node_) {
+        {
+            std::lock_guard lock(pending_frees_mutex);
+            pending_frees.push_back(node_);
+            has_pending_frees = true;
+        }
+        if (std::unique_lock lock(mutex_, std::try_to_lock); lock.owns_lock()) {
+            free_pending();
+        }
+    }
+
+    // must be called with the unique lock; nodes revived or pinned again meanwhile stay
+    void free_pending() {
+        if (!has_pending_frees.load()) {
+            return;
+        }
+
+        std::vector<node *> nodes;
+        {
+            std::lock_guard lock(pending_frees_mutex);
+            nodes.swap(pending_frees);
+            has_pending_frees = false;
+        }
+        for (node *node_: nodes) {
+            node_->clear_pending();
+            if (node_->need_free()) {
+                finally_erase(node_);
+            }
+        }
+    }
+
+    /*
+     * Removes a deleted node nothing pins any more. The node is found by its
+     * parent pointer, so there is no search from the root, and only the path
+     * above it is rebalanced, up to the first subtree whose height didn't change.
+     */
+    void finally_erase(node *node_) {
+        CONSISTENT_STATS_SCOPE(stats_, stats_op::FINALLY_ERASE);
+        node *parent = node_->get_parent();
+        bool is_left = parent->get_left() == node_;
+        node *left = node_->get_left();
+        node *right = node_->get_right();
+
+        node_->free();
+
+        node *replacement = left;
+        if (right != nullptr) {
+            node *min = find_min(right);
+            min->set_right(remove_min(right));
+            min->set_left(left);
+            replacement = balance(min);
+        }
+        is_left ? parent->set_left(replacement) : parent->set_right(replacement);
+
+        // a deleted node isn't in the counts, so only heights and balance can change above
+        rebalance_up(parent);
+        metrics_.set_height(get_height(HEAD_NODE->get_right()));
+    }
+
+    enum class set_op {
+        UNION, INTERSECTION, DIFFERENCE
+    };
+
+    // steps one side may fall behind the other before it searches instead
+    static const size_t SET_OP_GALLOP = 8;
+
+    template<typename Policy>
+    bool set_algebra_(Policy policy, set_op op, consistent_tree &other, consistent_tree &out) {
+        if (&out == this || &out == &other) {
+            return false;
+        }
+        std::shared_lock a_lock(mutex_, std::defer_lock);
+        std::shared_lock b_lock(other.mutex_, std::defer_lock);
+        std::unique_lock out_lock(out.mutex_, std::defer_lock);
+        if (&other == this) {
+            std::lock(a_lock, out_lock);
+        } else {
+            std::lock(a_lock, b_lock, out_lock);
+        }
+        out.prepare_move();
+        if (out.HEAD_NODE->get_right() != nullptr) {
+            return false;
+        }
+
+        // range i is [bounds[i], bounds[i + 1]), nullptr stands for no bound
+        std::vector<const value_t *> bounds{nullptr};
+        if constexpr (std::is_same_v<Policy, consistent_execution::parallel_policy>) {
+            consistent_tree &larger = other.size() > size() ? other : *this;
+            size_t n = larger.size();
+            size_t n_ranges = std::min(4 * policy.pool.size(), n / MIN_PARALLEL_TASK_SIZE);
+            for (size_t i = 1; i < n_ranges; ++i) {
+                bounds.push_back(&larger.nth_node(i * n / n_ranges)->get_value());
+            }
+        }
+        bounds.push_back(nullptr);
+
+        std::vector<std::vector<node *>> ranges(bounds.size() - 1);
+        auto build = [&](size_t i) {
+            out.set_range_(op, *this, other, bounds[i], bounds[i + 1], ranges[i]);
+        };
+        if constexpr (std::is_same_v<Policy, consistent_execution::parallel_policy>) {
+            std::vector<std::future<node *>> roots;
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                roots.push_back(policy.pool.submit([&, i] {
+                    build(i);
+                    return build_balanced(ranges[i], 0, ranges[i].size());
+                }));
+            }
+            node *root = nullptr;
+            for (auto &root_: roots) {
+                root = out.concat(root, policy.pool.wait(root_));
+            }
+            out.link_ranges(ranges);
+            out.reset_root(root);
+        } else {
+            build(0);
+            out.link_ranges(ranges);
+            out.reset_root(build_balanced(ranges[0], 0, ranges[0].size()));
+        }
+        return true;
+    }
+
+    // new nodes of this tree for the result in [lo, hi), in order
+    void set_range_(set_op op, consistent_tree &a, consistent_tree &b,
+                    const value_t *lo, const value_t *hi, std::vector<node *> &res) {
+        node *x = lo == nullptr ? a.first_node() : a.lower_bound_node(*lo);
+        node *y = lo == nullptr ? b.first_node() : b.lower_bound_node(*lo);
+        auto in_range = [&](consistent_tree &t, node *node_) {
+            return node_ != t.HEAD_NODE && (hi == nullptr || comp(node_->get_value(), *hi));
+        };
+        auto emit = [&](node *node_) {
+            res.push_back(new node(this, nullptr, node_->get_value()));
+        };
+        // steps past a node that isn't emitted; after SET_OP_GALLOP of them in a row, searches for target
+        auto skip = [&](consistent_tree &t, node *node_, size_t &skipped, const value_t &target) {
+            if (++skipped < SET_OP_GALLOP) {
+                return find_next(node_);
+            }
+            skipped = 0;
+            return t.lower_bound_node(target);
+        };
+
+        size_t x_skipped = 0;
+        size_t y_skipped = 0;
+        while (true) {
+            bool has_x = in_range(a, x);
+            bool has_y = in_range(b, y);
+            if (!has_x && (op != set_op::UNION || !has_y)) {
+                return;
+            }
+            if (!has_y && op == set_op::INTERSECTION) {
+                return;
+            }
+
+            if (has_x && (!has_y || comp(x->get_value(), y->get_value()))) {
+                if (op == set_op::INTERSECTION) {
+                    x = skip(a, x, x_skipped, y->get_value());
+                } else {
+                    emit(x);
+                    x = find_next(x);
+                }
+                y_skipped = 0;
+            } else if (!has_x || comp(y->get_value(), x->get_value())) {
+                if (op == set_op::UNION) {
+                    emit(y);
+                    y = find_next(y);
+                } else {
+                    y = skip(b, y, y_skipped, x->get_value());
+                }
+                x_skipped = 0;
+            } else {
+                if (op != set_op::DIFFERENCE) {
+                    emit(x);
+                }
+                x = find_next(x);
+                y = find_next(y);
+                x_skipped = y_skipped = 0;
+            }
+        }
+    }
+
+    // perfectly balanced subtree of nodes[from, to), which are in order and linked nowhere
+    node *build_balanced(const std::vector<node *> &nodes, size_t from, size_t to) {
+        if (from == to) {
+            return nullptr;
+        }
+        size_t mid = from + (to - from) / 2;
+        node *res = nodes[mid];
+        res->set_left(build_balanced(nodes, from, mid));
+        res->set_right(build_balanced(nodes, mid + 1, to));
+        fix_height(res);
+        return res;
+    }
+
+    // puts the nodes of consecutive ranges on the empty ring
+    void link_ranges(const std::vector<std::vector<node *>> &ranges) {
+        node *last = HEAD_NODE;
+        for (auto &range: ranges) {
+            for (node *node_: range) {
+                node::link(last, node_);
+                last = node_;
+            }
+        }
+        node::link(last, HEAD_NODE);
+    }
+
+    template<typename K>
+    bool split_(const K &key, consistent_tree &greater) {
+        CONSISTENT_LOCK_SITE("split");
+        if (&greater == this) {
+            return false;
+        }
+        std::scoped_lock lock(mutex_, greater.mutex_);
+        prepare_move();
+        greater.prepare_move();
+        if (greater.HEAD_NODE->get_right() != nullptr) {
+            return false;
+        }
+
+        node *first = lower_bound_any(key);
+        for (node *node_ = first; node_ != HEAD_NODE; node_ = node_->get_next()) {
+            if (!node_->is_movable()) {
+                return false;
+            }
+        }
+        if (first == HEAD_NODE) {
+            return true;
+        }
+
+        node *l;
+        node *r;
+        split_at(HEAD_NODE->get_right(), key, l, r);
+
+        node *last = HEAD_NODE->get_prev();
+        node::link(first->get_prev(), HEAD_NODE);
+        node::link(greater.HEAD_NODE, first);
+        node::link(last, greater.HEAD_NODE);
+        for (node *node_ = first; node_ != greater.HEAD_NODE; node_ = node_->get_next()) {
+            node_->tree = &greater;
+        }
+
+        reset_root(l);
+        greater.reset_root(r);
+        return true;
+    }
+
+    // under the unique lock, before nodes leave or join the tree
+    void prepare_move() {
+        apply_pending();
+        free_pending();
+    }
+
+    // every node can go to another tree
+    bool is_movable() {
+        for (node *node_ = HEAD_NODE->get_next(); node_ != HEAD_NODE; node_ = node_->get_next()) {
+            if (!node_->is_movable()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // every node here, deleted or not, is less than every node of other
+    bool is_before(consistent_tree &other) {
+        node *last = HEAD_NODE->get_prev();
+        node *first = other.HEAD_NODE->get_next();
+        return last == HEAD_NODE || first == other.HEAD_NODE || comp(last->get_value(), first->get_value());
+    }
+
+    // takes all nodes of other, which lie after ours if other_greater and before them otherwise
+    void absorb(consistent_tree &other, bool other_greater) {
+        node *root = other.HEAD_NODE->get_right();
+        if (root == nullptr) {
+            return;
+        }
+
+        node *first = other.HEAD_NODE->get_next();
+        node *last = other.HEAD_NODE->get_prev();
+        for (node *node_ = first; node_ != other.HEAD_NODE; node_ = node_->get_next()) {
+            node_->tree = this;
+        }
+        node *next_ = other_greater ? HEAD_NODE : HEAD_NODE->get_next();
+        node::link(next_->get_prev(), first);
+        node::link(last, next_);
+        node::link(other.HEAD_NODE, other.HEAD_NODE);
+        other.reset_root(nullptr);
+
+        node *mine = HEAD_NODE->get_right();
+        reset_root(other_greater ? concat(mine, root) : concat(root, mine));
+    }
+
+    // other's nodes interleave with ours, each one is linked in as a leaf
+    void merge_nodes(consistent_tree &other) {
+        std::vector<node *> nodes;
+        nodes.reserve(other.size_.load(std::memory_order_relaxed));
+        for (node *node_ = other.HEAD_NODE->get_next(); node_ != other.HEAD_NODE; node_ = node_->get_next()) {
+            nodes.push_back(node_);
+        }
+        node::link(other.HEAD_NODE, other.HEAD_NODE);
+        other.reset_root(nullptr);
+
+        for (node *node_: nodes) {
+            node *next_ = lower_bound_any(node_->get_value());
+            if (next_ != HEAD_NODE && !comp(node_->get_value(), next_->get_value())) {
+                // already here, stays in other, still in order
+                node_->reset(&other);
+                other.link_leaf(node_, other.HEAD_NODE);
+            } else {
+                node_->reset(this);
+                link_leaf(node_, next_);
+            }
+        }
+    }
+
+    // root, whose nodes the ring already holds in order, becomes the whole tree
+    void reset_root(node *root) {
+        HEAD_NODE->set_right(root);
+        size_.store(get_count(root), std::memory_order_relaxed);
+        first_live = HEAD_NODE->get_next();
+        if (first_live->is_deleted()) {
+            first_live = find_next(first_live);
+        }
+        last_live = HEAD_NODE->get_prev();
+        if (last_live->is_deleted()) {
+            last_live = find_prev(last_live);
+        }
+        metrics_.set_height(get_height(root));
+    }
+
+    /*
+     * AVL join: l < k < r, all detached. Descends the taller side to a subtree
+     * at most one level higher than the other, puts k on top of the two and
+     * rebalances back up, O(height difference).
+     */
+    node *join_with(node *l, node *k, node *r) {
+        height_t hl = get_height(l);
+        height_t hr = get_height(r);
+        if (hl > hr + 1) {
+            l->set_right(join_with(l->get_right(), k, r));
+            return balance(l);
+        }
+        if (hr > hl + 1) {
+            r->set_left(join_with(l, k, r->get_left()));
+            return balance(r);
+        }
+        k->set_left(l);
+        k->set_right(r);
+        fix_height(k);
+        return k;
+    }
+
+    // every key of l is less than every key of r
+    node *concat(node *l, node *r) {
+        if (l == nullptr) {
+            return r;
+        }
+        if (r == nullptr) {
+            return l;
+        }
+        node *min = find_min(r);
+        return join_with(l, min, remove_min(r));
+    }
+
+    // l gets the nodes less than key, r the rest; one comparison per level, joins along the way
+    template<typename K>
+    void split_at(node *node_, const K &key, node *&l, node *&r) {
+        if (node_ == nullptr) {
+            l = r = nullptr;
+            return;
+        }
+
+        node *left = node_->get_left();
+        node *right = node_->get_right();
+        if (comp(node_->get_value(), key)) {
+            split_at(right, key, l, r);
+            l = join_with(left, node_, l);
+        } else {
+            split_at(left, key, l, r);
+            r = join_with(r, node_, right);
+        }
+    }
+
+    // balances node_ and its ancestors, up to the first subtree that kept its root and height
+    void rebalance_up(node *node_) {
+        while (node_ != HEAD_NODE) {
+            node *parent = node_->get_parent();
+            bool is_left = parent->get_left() == node_;
+            height_t height = node_->get_height();
+
+            node *res = balance(node_);
+            if (res == node_ && res->get_height() == height) {
+                break;
+            }
+            is_left ? parent->set_left(res) : parent->set_right(res);
+            node_ = parent;
+        }
+    }
+
+    // k-th (from 0) live node, HEAD_NODE if there are not enough
+    node *nth_node(size_t k) {
+        node *node_ = HEAD_NODE->get_right();
+        while (node_ != nullptr) {
+            size_t left_count = get_count(node_->get_left());
+            if (k < left_count) {
+                node_ = node_->get_left();
+                continue;
+            }
+
+            k -= left_count;
+            if (!node_->is_deleted()) {
+                if (k == 0) {
+                    return node_;
+                }
+                k--;
+            }
+            node_ = node_->get_right();
+        }
+        return HEAD_NODE;
+    }
+
+    static constexpr size_t BATCH_GROUP = 16;
+
+    // calls found(i, live node equal to keys[i] or nullptr) for every key, see find_batch()
+    template<typename F>
+    void find_batch_(const std::vector<value_t> &keys, F found) {
+        node *current[BATCH_GROUP];
+        node *candidate[BATCH_GROUP];
+        for (size_t from = 0; from < keys.size(); from += BATCH_GROUP) {
+            size_t n = std::min(BATCH_GROUP, keys.size() - from);
+            for (size_t i = 0; i < n; ++i) {
+                current[i] = HEAD_NODE->get_right();
+                candidate[i] = nullptr;
+            }
+
+            // the same descent as lower_bound_any(), interleaved
+            for (bool descending = true; descending;) {
+                descending = false;
+                for (size_t i = 0; i < n; ++i) {
+                    node *node_ = current[i];
+                    if (node_ == nullptr) {
+                        continue;
+                    }
+                    if (comp(node_->get_value(), keys[from + i])) {
+                        node_ = node_->get_right();
+                    } else {
+                        candidate[i] = node_;
+                        node_ = node_->get_left();
+                    }
+                    if (node_ != nullptr) {
+                        CONSISTENT_PREFETCH(node_);
+                        descending = true;
+                    }
+                    current[i] = node_;
+                }
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                node *res = candidate[i];
+                bool hit = res != nullptr && !res->is_deleted() && !comp(keys[from + i], res->get_value());
+                found(from + i, hit ? res : nullptr);
+            }
+        }
+    }
+
+    // first node not less than key, deleted or not, HEAD_NODE if there is none
+    template<typename K>
+    node *lower_bound_any(const K &key) {
+        node *res = HEAD_NODE;
+        node *node_ = HEAD_NODE->get_right();
+        while (node_ != nullptr) {
+            if (comp(node_->get_value(), key)) {
+                node_ = node_->get_right();
+            } else {
+                res = node_;
+                node_ = node_->get_left();
+            }
+        }
+        return res;
+    }
+
+    // node with an equal key, deleted or not, nullptr if there is none
+    template<typename K>
+    node *find_node(const K &key) {
+        node *res = lower_bound_any(key);
+        return res != HEAD_NODE && !comp(key, res->get_value()) ? res : nullptr;
+    }
+
+    static node *find_min(node *node_) {
+        return node_->get_left() == nullptr ? node_ : find_min(node_->get_left());
+    }
+
+    static node *find_max(node *node_) {
+        return node_->get_right() == nullptr ? node_ : find_max(node_->get_right());
+    }
+
+    // in-order neighbours, HEAD_NODE stands before the first and after the last node
+    static node *successor(node *node_) {
+        return node_ == node_->get_parent() ? node_ : node_->get_next();
+    }
+
+    static node *predecessor(node *node_) {
+        return node_->get_prev();
+    }
+
+    // HEAD_NODE is never deleted, so both loops stop at it at the latest
+    static node *find_next(node *node_) {
+        do {
+            node_ = successor(node_);
+        } while (node_->is_deleted());
+        return node_;
+    }
+
+    static node *find_prev(node *node_) {
+        do {
+            node_ = predecessor(node_);
+        } while (node_->is_deleted());
+        return node_;
+    }
+
+    class iterator {
+    private:
+        node *current_node = nullptr;
+    public:
         iterator() = default;
 
         explicit iterator(node *node_) {
@@ -565,7 +2035,6 @@ public:
 
         ~iterator() {
             if (current_node != nullptr) {
-                auto v = current_node->get_value();
                 current_node->add_ref_count(-1);
             }
         }
@@ -574,24 +2043,178 @@ public:
             return value_node(current_node);
         }
 
-        iterator operator++() {
-            node *next = find_next(current_node);
-            acquire(&current_node, next);
-            return iterator(next);
+        // the value without a copy or a lock, valid while the iterator pins the node
+        const value_t &value() const {
+            return current_node->get_value();
+        }
+
+        const value_t *operator->() const {
+            return &current_node->get_value();
         }
 
-        iterator operator--() {
-            node *prev = find_prev(current_node);
-            acquire(&current_node, prev);
-            return iterator(prev);
+        node *get_node() const {
+            return current_node;
         }
 
-        bool operator==(const iterator &rhs) {
+        // the walk needs the shared lock, the old node is released after it
+        iterator &operator++() {
+            CONSISTENT_LOCK_SITE("iterator++");
+            CONSISTENT_STATS_SCOPE(current_node->tree->stats_, stats_op::ITERATE);
+            node *old = current_node;
+            {
+                std::shared_lock lock(old->tree->mutex_);
+                current_node = find_next(old);
+                current_node->add_ref_count(1);
+            }
+            old->add_ref_count(-1);
+            return *this;
+        }
+
+        iterator &operator--() {
+            CONSISTENT_LOCK_SITE("iterator--");
+            CONSISTENT_STATS_SCOPE(current_node->tree->stats_, stats_op::ITERATE);
+            node *old = current_node;
+            {
+                std::shared_lock lock(old->tree->mutex_);
+                current_node = find_prev(old);
+                current_node->add_ref_count(1);
+            }
+            old->add_ref_count(-1);
+            return *this;
+        }
+
+        bool operator==(const iterator &rhs) const {
             return &(*this->current_node) == &(*rhs.current_node);
         }
 
-        bool operator!=(const iterator &rhs) {
+        bool operator!=(const iterator &rhs) const {
             return &(*this->current_node) != &(*rhs.current_node);
         }
     };
-};
\ No newline at end of file
+
+    // pins a node like an iterator does and gives access to its value without copying
+    class value_guard {
+    private:
+        iterator it;
+        node *current_node = nullptr;
+    public:
+        value_guard() = default;
+
+        explicit value_guard(node *node_) : it(node_), current_node(node_) {}
+
+        const value_t &get() const {
+            return current_node->get_value();
+        }
+
+        const value_t &operator*() const {
+            return get();
+        }
+
+        const value_t *operator->() const {
+            return &get();
+        }
+
+        explicit operator bool() const {
+            return current_node != nullptr;
+        }
+    };
+
+    /*
+     * Holds the shared lock while it lives, so the tree can't change under a
+     * scan: cursors step with plain pointer loads and never write reference
+     * counts, unlike iterators, which pin every node they pass. Writers wait
+     * for the guard, so keep it short-lived, and don't insert, erase or move
+     * iterators from the thread that holds it. pin() makes an iterator that
+     * outlives the guard.
+     */
+    class read_guard {
+    public:
+        class cursor {
+        private:
+            node *current_node;
+
+            friend class read_guard;
+
+        public:
+            explicit cursor(node *node_) : current_node(node_) {}
+
+            const value_t &operator*() const {
+                return current_node->get_value();
+            }
+
+            const value_t *operator->() const {
+                return &current_node->get_value();
+            }
+
+            cursor &operator++() {
+                current_node = find_next(current_node);
+                return *this;
+            }
+
+            cursor &operator--() {
+                current_node = find_prev(current_node);
+                return *this;
+            }
+
+            bool operator==(const cursor &rhs) const {
+                return current_node == rhs.current_node;
+            }
+
+            bool operator!=(const cursor &rhs) const {
+                return current_node != rhs.current_node;
+            }
+        };
+
+    private:
+        consistent_tree *tree;
+        std::shared_lock<decltype(consistent_tree::mutex_)> lock;
+
+    public:
+        explicit read_guard(consistent_tree *tree_) : tree(tree_), lock(tree_->mutex_) {}
+
+        read_guard(const read_guard &) = delete;
+
+        read_guard &operator=(const read_guard &) = delete;
+
+        cursor begin() const {
+            return cursor(tree->first_node());
+        }
+
+        cursor end() const {
+            return cursor(tree->HEAD_NODE);
+        }
+
+        cursor find(const value_t &value_) const {
+            return find_<value_t>(value_);
+        }
+
+        template<typename K, typename C = Compare, typename = if_transparent<K, C>>
+        cursor find(const K &key) const {
+            return find_<K>(key);
+        }
+
+        cursor lower_bound(const value_t &value_) const {
+            return cursor(tree->lower_bound_node(value_));
+        }
+
+        template<typename K, typename C = Compare, typename = if_transparent<K, C>>
+        cursor lower_bound(const K &key) const {
+            return cursor(tree->lower_bound_node(key));
+        }
+
+        size_t size() const {
+            return tree->size_.load(std::memory_order_relaxed);
+        }
+
+        iterator pin(const cursor &position) const {
+            return iterator(position.current_node);
+        }
+
+    private:
+        template<typename K>
+        cursor find_(const K &key) const {
+            node *res = tree->find_node(key);
+            return cursor(res == nullptr || res->is_deleted() ? tree->HEAD_NODE : res);
+        }
+    };
+};
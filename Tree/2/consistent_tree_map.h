@@ -0,0 +1,192 @@
+#pragma once
+
+#include <optional>
+#include <utility>
+
+#include "consistent_tree.h"
+
+/*
+ * Ordered map on top of consistent_tree. Changing a mapped value never
+ * touches the tree structure: the node is found under the tree's shared
+ * lock and the value is changed under the tree's striped value_mutex, so
+ * readers and writers of other keys keep running.
+ */
+template<typename K, typename V, typename Compare = std::less<K>>
+class consistent_tree_map {
+public:
+    using key_t = K;
+    using mapped_t = V;
+
+    class entry {
+    public:
+        K key;
+        V value;
+
+        entry() = default;
+
+        entry(K key_, V value_) : key(std::move(key_)), value(std::move(value_)) {}
+    };
+
+    // orders entries by key only and compares them with bare keys, so lookups
+    // don't have to build an entry
+    class entry_compare {
+    public:
+        using is_transparent = void;
+
+        Compare comp;
+
+        bool operator()(const entry &lhs, const entry &rhs) const {
+            return comp(lhs.key, rhs.key);
+        }
+
+        bool operator()(const entry &lhs, const K &rhs) const {
+            return comp(lhs.key, rhs);
+        }
+
+        bool operator()(const K &lhs, const entry &rhs) const {
+            return comp(lhs, rhs.key);
+        }
+    };
+
+    using tree_t = consistent_tree<entry, entry_compare>;
+    using node = typename tree_t::node;
+    using iterator = typename tree_t::iterator;
+
+private:
+    tree_t tree;
+
+    // the caller holds tree.mutex_
+    node *find_node(const K &key) {
+        node *res = tree.find_node(key);
+        return res == nullptr || res->is_deleted() ? nullptr : res;
+    }
+
+    template<typename... Args>
+    node *insert_node(const K &key, Args &&... args) {
+        return tree.insert_(entry(key, V(std::forward<Args>(args)...)));
+    }
+
+public:
+    // true if the key was inserted, false if an existing value was assigned
+    template<typename M>
+    bool insert_or_assign(const K &key, M &&value) {
+        CONSISTENT_LOCK_SITE("insert");
+        return tree.with_unique_lock([&] {
+            node *node_ = find_node(key);
+            if (node_ == nullptr) {
+                insert_node(key, std::forward<M>(value));
+                return true;
+            }
+
+            std::unique_lock value_lock(tree.value_mutex(node_));
+            node_->get_mutable_value().value = std::forward<M>(value);
+            return false;
+        });
+    }
+
+    // constructs the value only if the key is absent
+    template<typename... Args>
+    bool try_emplace(const K &key, Args &&... args) {
+        CONSISTENT_LOCK_SITE("insert");
+        return tree.with_unique_lock([&] {
+            if (find_node(key) != nullptr) {
+                return false;
+            }
+
+            insert_node(key, std::forward<Args>(args)...);
+            return true;
+        });
+    }
+
+    // like std::map, the reference is not synchronized and lives until the key
+    // is erased; use update() to change the value concurrently
+    V &operator[](const K &key) {
+        CONSISTENT_LOCK_SITE("insert");
+        node *node_ = tree.with_unique_lock([&] {
+            node *res = find_node(key);
+            return res == nullptr ? insert_node(key) : res;
+        });
+        return node_->get_mutable_value().value;
+    }
+
+    // calls fn(V &) under the value's lock, false if there is no such key
+    template<typename F>
+    bool update(const K &key, F fn) {
+        CONSISTENT_LOCK_SITE("update");
+        iterator pin;
+        node *node_;
+        {
+            std::shared_lock lock(tree.mutex_);
+            node_ = find_node(key);
+            if (node_ == nullptr) {
+                return false;
+            }
+            pin = iterator(node_);
+        }
+
+        std::unique_lock value_lock(tree.value_mutex(node_));
+        if (node_->is_deleted()) {
+            return false;
+        }
+        fn(node_->get_mutable_value().value);
+        return true;
+    }
+
+    std::optional<V> get(const K &key) {
+        CONSISTENT_LOCK_SITE("find");
+        std::shared_lock lock(tree.mutex_);
+        node *node_ = find_node(key);
+        if (node_ == nullptr) {
+            return std::nullopt;
+        }
+
+        std::shared_lock value_lock(tree.value_mutex(node_));
+        return node_->get_value().value;
+    }
+
+    bool contains(const K &key) {
+        CONSISTENT_LOCK_SITE("find");
+        std::shared_lock lock(tree.mutex_);
+        return find_node(key) != nullptr;
+    }
+
+    void erase(const K &key) {
+        CONSISTENT_LOCK_SITE("erase");
+        tree.with_unique_lock([&] {
+            tree.try_remove(key);
+        });
+    }
+
+    size_t size() {
+        return tree.size();
+    }
+
+    bool empty() {
+        return tree.empty();
+    }
+
+    void clear() {
+        tree.clear();
+    }
+
+    lock_stats_snapshot lock_stats() {
+        return tree.lock_stats();
+    }
+
+    container_metrics metrics() const {
+        return tree.metrics();
+    }
+
+
+    iterator find(const K &key) {
+        return tree.find(key);
+    }
+
+    iterator begin() {
+        return tree.begin();
+    }
+
+    iterator end() {
+        return tree.end();
+    }
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// point-in-time copy of live_metrics
+class container_metrics {
+public:
+    // erased nodes that are still allocated because iterators pin them
+    uint64_t tombstones = 0;
+    // nodes with at least one iterator on them
+    uint64_t pinned_nodes = 0;
+    // nodes physically freed since the container was created
+    uint64_t frees = 0;
+    // single rotations and balance() calls that rotated, zero for lists
+    uint64_t rotations = 0;
+    uint64_t rebalances = 0;
+    // current and largest seen height, zero for lists
+    uint64_t height = 0;
+    uint64_t max_height = 0;
+
+    std::chrono::steady_clock::time_point taken_at;
+
+    // frees per second between an earlier snapshot and this one
+    double frees_per_second(const container_metrics &earlier) const {
+        std::chrono::duration<double> elapsed = taken_at - earlier.taken_at;
+        return elapsed.count() > 0 ? (double) (frees - earlier.frees) / elapsed.count() : 0;
+    }
+
+    void dump(std::ostream &out) const {
+        out << "tombstones " << tombstones << ", pinned nodes " << pinned_nodes << ", frees " << frees
+            << ", rotations " << rotations << ", rebalances " << rebalances
+            << ", height " << height << ", max height " << max_height << "\n";
+    }
+};
+
+/*
+ * Counters the containers keep up to date on every operation. They are
+ * relaxed atomics, so reading them never blocks the container, and a
+ * snapshot taken while operations run may be off by the operations in flight.
+ */
+class live_metrics {
+public:
+    std::atomic<int64_t> tombstones{0};
+    std::atomic<int64_t> pinned_nodes{0};
+    std::atomic<uint64_t> frees{0};
+    std::atomic<uint64_t> rotations{0};
+    std::atomic<uint64_t> rebalances{0};
+    std::atomic<uint64_t> height{0};
+    std::atomic<uint64_t> max_height{0};
+
+    static void add(std::atomic<int64_t> &counter, int64_t n) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t n) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // an iterator reference moved the node's iterator count from `before`
+    void on_pin(int64_t before, int n) {
+        if (before == 0 && n > 0) {
+            add(pinned_nodes, 1);
+        } else if (before > 0 && before + n == 0) {
+            add(pinned_nodes, -1);
+        }
+    }
+
+    // called under the writers' lock, so only max_height needs no lost updates
+    void set_height(uint64_t height_) {
+        height.store(height_, std::memory_order_relaxed);
+        if (height_ > max_height.load(std::memory_order_relaxed)) {
+            max_height.store(height_, std::memory_order_relaxed);
+        }
+    }
+
+    // the container dropped all its nodes; iterators still unpin theirs, so pinned_nodes stays
+    void reset() {
+        tombstones = 0;
+        height = 0;
+    }
+
+    container_metrics snapshot() const {
+        container_metrics res;
+        // the counters move independently, a transient negative value reads as zero
+        int64_t tombstones_ = tombstones.load(std::memory_order_relaxed);
+        int64_t pinned_nodes_ = pinned_nodes.load(std::memory_order_relaxed);
+        res.tombstones = tombstones_ > 0 ? tombstones_ : 0;
+        res.pinned_nodes = pinned_nodes_ > 0 ? pinned_nodes_ : 0;
+        res.frees = frees.load(std::memory_order_relaxed);
+        res.rotations = rotations.load(std::memory_order_relaxed);
+        res.rebalances = rebalances.load(std::memory_order_relaxed);
+        res.height = height.load(std::memory_order_relaxed);
+        res.max_height = max_height.load(std::memory_order_relaxed);
+        res.taken_at = std::chrono::steady_clock::now();
+        return res;
+    }
+};
@@ -1,8 +1,14 @@
 #include "tests/tree_test.h"
 #include "tests/coarse_grained_test.h"
+#include "tests/skip_list_test.h"
+#include "tests/sharded_tree_test.h"
+#include "tests/map_test.h"
 
 int main() {
     tree_test().run();
     coarse_grained_test(4).run();
+    skip_list_test(4).run();
+    sharded_tree_test(4).run();
+    map_test(4).run();
     return 0;
 }
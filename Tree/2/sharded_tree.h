@@ -0,0 +1,206 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <optional>
+
+#include "consistent_tree.h"
+
+/*
+ * Hash-partitions keys over Shards independent consistent_trees, so writers
+ * of different shards never wait for each other. Iteration merges the shards
+ * back into one ordered sequence.
+ */
+template<typename T, size_t Shards = 8, typename Hash = std::hash<T>>
+class sharded_tree {
+public:
+    using value_t = T;
+    using tree_t = consistent_tree<T>;
+
+    class iterator;
+
+private:
+    std::array<tree_t, Shards> shards;
+    Hash hash;
+
+    tree_t &shard(const value_t &value_) {
+        return shards[hash(value_) % Shards];
+    }
+
+public:
+    sharded_tree() = default;
+
+    sharded_tree(const sharded_tree &) = delete;
+
+    sharded_tree &operator=(const sharded_tree &) = delete;
+
+
+    void insert(const value_t &value_) {
+        shard(value_).insert(value_);
+    }
+
+    void erase(const value_t &value_) {
+        shard(value_).erase(value_);
+    }
+
+    void erase(const iterator &it) {
+        erase(*it);
+    }
+
+    iterator find(const value_t &value_) {
+        if (shard(value_).find(value_) == shard(value_).end()) {
+            return end();
+        }
+
+        iterator it;
+        for (size_t i = 0; i < Shards; ++i) {
+            it.its[i] = shards[i].lower_bound(value_);
+            it.ends[i] = shards[i].end();
+        }
+        it.fetch_all();
+        return it;
+    }
+
+    // sums the shards' counters without locking, so concurrent writes may be half counted
+    size_t size() {
+        size_t res = 0;
+        for (auto &tree: shards) {
+            res += tree.size();
+        }
+        return res;
+    }
+
+    bool empty() {
+        for (auto &tree: shards) {
+            if (!tree.empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the smallest value over all shards, std::nullopt if every shard is empty
+    std::optional<value_t> front() {
+        std::optional<value_t> res;
+        for (auto &tree: shards) {
+            std::optional<value_t> value_ = tree.front();
+            if (value_ && (!res || *value_ < *res)) {
+                res = std::move(value_);
+            }
+        }
+        return res;
+    }
+
+    std::optional<value_t> back() {
+        std::optional<value_t> res;
+        for (auto &tree: shards) {
+            std::optional<value_t> value_ = tree.back();
+            if (value_ && (!res || *res < *value_)) {
+                res = std::move(value_);
+            }
+        }
+        return res;
+    }
+
+    void clear() {
+        for (auto &tree: shards) {
+            tree.clear();
+        }
+    }
+
+
+    iterator begin() {
+        iterator it;
+        for (size_t i = 0; i < Shards; ++i) {
+            it.its[i] = shards[i].begin();
+            it.ends[i] = shards[i].end();
+        }
+        it.fetch_all();
+        return it;
+    }
+
+    iterator end() {
+        return iterator();
+    }
+
+
+    std::vector<value_t> to_vector() {
+        std::vector<value_t> v;
+        for (auto it = begin(); it != end(); ++it) {
+            v.push_back(*it);
+        }
+        return v;
+    }
+
+    tree_t &get_shard(size_t i) {
+        return shards[i];
+    }
+
+    // forward iterator doing a k-way merge of the shards' iterators
+    class iterator {
+    private:
+        friend class sharded_tree;
+
+        std::array<typename tree_t::iterator, Shards> its;
+        std::array<typename tree_t::iterator, Shards> ends;
+        std::array<value_t, Shards> values;
+        std::array<bool, Shards> valid{};
+
+        // index of the shard holding the current element, Shards at the end
+        size_t current = Shards;
+
+        void fetch(size_t i) {
+            valid[i] = its[i] != ends[i];
+            if (valid[i]) {
+                values[i] = (*its[i]).get();
+            }
+        }
+
+        void fetch_all() {
+            for (size_t i = 0; i < Shards; ++i) {
+                fetch(i);
+            }
+            select();
+        }
+
+        void select() {
+            current = Shards;
+            for (size_t i = 0; i < Shards; ++i) {
+                if (valid[i] && (current == Shards || values[i] < values[current])) {
+                    current = i;
+                }
+            }
+        }
+
+    public:
+        iterator() = default;
+
+        const value_t &operator*() const {
+            return values[current];
+        }
+
+        const value_t *operator->() const {
+            return &values[current];
+        }
+
+        iterator &operator++() {
+            if (current != Shards) {
+                ++its[current];
+                fetch(current);
+                select();
+            }
+            return *this;
+        }
+
+        bool operator==(const iterator &rhs) const {
+            if (current == Shards || rhs.current == Shards) {
+                return current == rhs.current;
+            }
+            return current == rhs.current && its[current] == rhs.its[current];
+        }
+
+        bool operator!=(const iterator &rhs) const {
+            return !(*this == rhs);
+        }
+    };
+};
@@ -1,8 +1,39 @@
 #pragma once
 
 #include "../consistent_tree.h"
+#include "../workload_driver.h"
 #include <thread>
 #include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+// ordered by key, a and b are changed in place together
+struct two_counters {
+    int key;
+    int a = 0;
+    int b = 0;
+
+    two_counters(int key_ = 0) : key(key_) {}
+
+    bool operator<(const two_counters &rhs) const { return key < rhs.key; }
+};
+
+// copying a negative key throws, whichever thread does the copy
+struct throwing_copy {
+    int key;
+
+    throwing_copy(int key_ = 0) : key(key_) {}
+
+    throwing_copy(const throwing_copy &rhs) : key(rhs.key) {
+        if (key < 0) {
+            throw std::runtime_error("negative key");
+        }
+    }
+
+    throwing_copy &operator=(const throwing_copy &rhs) = default;
+
+    bool operator<(const throwing_copy &rhs) const { return key < rhs.key; }
+};
 
 class coarse_grained_test {
 private:
@@ -11,6 +42,7 @@ private:
     size_t fail_counter = 0;
 
     size_t n_threads = 0;
+    workload_driver driver;
 
     void REQUIRE(bool result, const std::string &reason = "") {
         test_counter++;
@@ -30,27 +62,20 @@ private:
     }
 
 public:
-    coarse_grained_test(size_t n_treads_ = 1) : n_threads(n_treads_) {}
+    coarse_grained_test(size_t n_treads_ = 1) : n_threads(n_treads_), driver(n_treads_) {}
 
     void insert_one_number() {
         test_case = "insert_one_number";
 
         consistent_tree<int> tree;
 
-        std::vector<std::thread> vt(n_threads);
         int n_numbers = 1e3;
 
-        for (int i = 0; i < vt.size(); ++i) {
-            vt[i] = std::thread([&]() -> void {
-                for (int j = 0; j < n_numbers; ++j) {
-                    tree.insert(1);
-                }
-            });
-        }
-
-        for (int i = 0; i < n_threads; ++i) {
-            vt[i].join();
-        }
+        driver.run([&](size_t) {
+            for (int j = 0; j < n_numbers; ++j) {
+                tree.insert(1);
+            }
+        });
 
 
         REQUIRE(tree.size() == 1, "case 1");
@@ -62,20 +87,13 @@ public:
 
         consistent_tree<int> tree;
 
-        std::vector<std::thread> vt(n_threads);
         int n_numbers = 1e3;
 
-        for (int i = 0; i < vt.size(); ++i) {
-            vt[i] = std::thread([&]() -> void {
-                for (int j = 0; j < n_numbers; ++j) {
-                    tree.insert(j);
-                }
-            });
-        }
-
-        for (int i = 0; i < n_threads; ++i) {
-            vt[i].join();
-        }
+        driver.run([&](size_t) {
+            for (int j = 0; j < n_numbers; ++j) {
+                tree.insert(j);
+            }
+        });
 
 
         REQUIRE(tree.size() == n_numbers, "case 1");
@@ -89,20 +107,14 @@ public:
 
         consistent_tree<int> tree;
 
-        std::vector<std::thread> vt(n_threads);
         int n_numbers = 1e3;
 
-        for (int i = 0; i < vt.size(); ++i) {
-            vt[i] = std::thread([&](int start) -> void {
-                for (int j = start; j < start + n_numbers; ++j) {
-                    tree.insert(j);
-                }
-            }, n_numbers * i);
-        }
-
-        for (int i = 0; i < n_threads; ++i) {
-            vt[i].join();
-        }
+        driver.run([&](size_t i) {
+            int start = n_numbers * (int) i;
+            for (int j = start; j < start + n_numbers; ++j) {
+                tree.insert(j);
+            }
+        });
 
 
         REQUIRE(tree.size() == n_threads * n_numbers, "case 1");
@@ -111,30 +123,181 @@ public:
         }
     }
 
-    void erase_same_numbers() {
-        test_case = "erase_same_numbers";
+    void insert_and_erase_different_numbers() {
+        test_case = "insert_and_erase_different_numbers";
 
         consistent_tree<int> tree;
 
-        int n_numbers = 1e5;
-        for (int i = 0; i < n_numbers; ++i) {
-            tree.insert(i);
+        int n_numbers = 1e4;
+
+        driver.run([&](size_t i) {
+            int start = n_numbers * (int) i;
+            for (int j = start; j < start + n_numbers; ++j) {
+                tree.insert(j);
+                if (j % 2) {
+                    tree.erase(j);
+                }
+            }
+        });
+
+
+        REQUIRE(tree.size() == n_threads * n_numbers / 2, "case 1");
+        for (int i = 0; i < n_threads * n_numbers; ++i) {
+            REQUIRE((tree.find(i) != tree.end()) == (i % 2 == 0), "case 2");
         }
+    }
+
+    void size_while_inserting() {
+        test_case = "size_while_inserting";
 
-        std::vector<std::thread> vt(n_threads);
+        consistent_tree<int> tree;
+
+        int n_numbers = 1e4;
+        bool monotonic = true;
+
+        driver.run([&](size_t i) {
+            if (i == 0) {
+                size_t prev = 0;
+                while (prev < (n_threads - 1) * n_numbers) {
+                    size_t size = tree.size();
+                    monotonic &= prev <= size;
+                    prev = size;
+                }
+                return;
+            }
+
+            for (int j = i * n_numbers; j < (i + 1) * n_numbers; ++j) {
+                tree.insert(j);
+            }
+        });
+
+        REQUIRE(monotonic, "case 1");
+        REQUIRE(tree.size() == (n_threads - 1) * n_numbers, "case 2");
+    }
+
+    void chunked_to_vector_while_inserting() {
+        test_case = "chunked_to_vector_while_inserting";
+
+        consistent_tree<int> tree;
 
-        for (int i = 0; i < vt.size(); ++i) {
-            vt[i] = std::thread([&]() -> void {
-                for (int j = 0; j < n_numbers; ++j) {
+        int n_numbers = 1e4;
+        std::vector<char> sorted(n_threads, true);
+
+        driver.run([&](size_t i) {
+            if (i == 0) {
+                for (int j = 0; j < 10; ++j) {
+                    int prev = -1;
+                    tree.to_vector_chunked(64, [&](const std::vector<int> &chunk) {
+                        for (auto it: chunk) {
+                            sorted[i] &= prev < it;
+                            prev = it;
+                        }
+                    });
+                }
+                return;
+            }
+
+            for (int j = i * n_numbers; j < (i + 1) * n_numbers; ++j) {
+                tree.insert(j);
+                if (j % 2) {
                     tree.erase(j);
                 }
-            });
+            }
+        });
+
+        for (int i = 0; i < n_threads; ++i) {
+            REQUIRE(sorted[i], "case 1");
         }
 
+        REQUIRE(tree.size() == (n_threads - 1) * n_numbers / 2, "case 2");
+    }
+
+    void read_guard_while_inserting() {
+        test_case = "read_guard_while_inserting";
+
+        consistent_tree<int> tree;
+
+        int n_numbers = 1e4;
+        std::vector<char> consistent(n_threads, true);
+
+        driver.run([&](size_t i) {
+            if (i == 0) {
+                for (int j = 0; j < 100; ++j) {
+                    auto guard = tree.read();
+                    size_t n = 0;
+                    int prev = -1;
+                    for (int it: guard) {
+                        consistent[i] &= prev < it;
+                        prev = it;
+                        n++;
+                    }
+                    consistent[i] &= n == guard.size();
+                }
+                return;
+            }
+
+            for (int j = i * n_numbers; j < (i + 1) * n_numbers; ++j) {
+                tree.insert(j);
+                if (j % 2) {
+                    tree.erase(j);
+                }
+            }
+        });
+
         for (int i = 0; i < n_threads; ++i) {
-            vt[i].join();
+            REQUIRE(consistent[i], "case 1");
         }
 
+        REQUIRE(tree.size() == (n_threads - 1) * n_numbers / 2, "case 2");
+    }
+
+    void update_while_reading() {
+        test_case = "update_while_reading";
+
+        consistent_tree<two_counters> tree;
+        int n_keys = 64;
+        for (int i = 0; i < n_keys; ++i) {
+            tree.insert(two_counters(i));
+        }
+        std::vector<char> consistent(n_threads, true);
+
+        // half of the threads write a and b together, the others must never see them differ
+        driver.run([&](size_t i) {
+            for (int j = 0; j < 1e3; ++j) {
+                auto it = tree.find(two_counters(j % n_keys));
+                if (i % 2) {
+                    (*it).update([j](two_counters &value_) {
+                        value_.a = j;
+                        value_.b = j;
+                    });
+                } else {
+                    two_counters value_ = (*it).get();
+                    consistent[i] &= value_.a == value_.b;
+                }
+            }
+        });
+
+        for (int i = 0; i < n_threads; ++i) {
+            REQUIRE(consistent[i], "case 1");
+        }
+    }
+
+    void erase_same_numbers() {
+        test_case = "erase_same_numbers";
+
+        consistent_tree<int> tree;
+
+        int n_numbers = 1e5;
+        for (int i = 0; i < n_numbers; ++i) {
+            tree.insert(i);
+        }
+
+        driver.run([&](size_t) {
+            for (int j = 0; j < n_numbers; ++j) {
+                tree.erase(j);
+            }
+        });
+
         REQUIRE(tree.empty(), "case 1");
     }
 
@@ -148,19 +311,12 @@ public:
             tree.insert(i);
         }
 
-        std::vector<std::thread> vt(n_threads);
-
-        for (int i = 0; i < vt.size(); ++i) {
-            vt[i] = std::thread([&](int start) -> void {
-                for (int j = start; j < start + n_numbers; ++j) {
-                    tree.erase(j);
-                }
-            }, i * n_numbers);
-        }
-
-        for (int i = 0; i < n_threads; ++i) {
-            vt[i].join();
-        }
+        driver.run([&](size_t i) {
+            int start = (int) i * n_numbers;
+            for (int j = start; j < start + n_numbers; ++j) {
+                tree.erase(j);
+            }
+        });
 
         REQUIRE(tree.empty(), "case 1");
     }
@@ -175,31 +331,24 @@ public:
             tree.insert(i);
         }
 
-        std::vector<std::thread> vt(n_threads);
-
-        for (int i = 0; i < vt.size(); ++i) {
-            vt[i] = std::thread([&](int side) -> void {
-                if (side) {
-                    for (int j = 0; j < n_numbers; j++) {
-                        tree.erase(j);
-                    }
-                } else {
-                    for (int j = n_numbers - 1; j >= 0; j--) {
-                        tree.erase(j);
-                    }
+        driver.run([&](size_t i) {
+            int side = (int) i % 2;
+            if (side) {
+                for (int j = 0; j < n_numbers; j++) {
+                    tree.erase(j);
                 }
-            }, i % 2);
-        }
-
-        for (int i = 0; i < n_threads; ++i) {
-            vt[i].join();
-        }
+            } else {
+                for (int j = n_numbers - 1; j >= 0; j--) {
+                    tree.erase(j);
+                }
+            }
+        });
 
         REQUIRE(tree.empty(), "case 1");
     }
 
     void find() {
-        test_case = "erase_from_different_sides";
+        test_case = "find";
 
         consistent_tree<int> tree;
 
@@ -208,22 +357,90 @@ public:
             tree.insert(i);
         }
 
-        std::vector<std::thread> vt(n_threads);
+        std::vector<char> found(n_threads, true);
+        driver.run([&](size_t i) {
+            for (int j = 0; j < n_numbers; j++) {
+                found[i] &= tree.find(j) != tree.end();
+                found[i] &= tree.find(-j - 1) == tree.end();
+            }
+        });
 
-        for (int i = 0; i < vt.size(); ++i) {
-            vt[i] = std::thread([&]() -> void {
-                for (int j = 0; j < n_numbers; j++) {
-                    REQUIRE(tree.find(j) != tree.end());
-                    REQUIRE(tree.find(-j - 1) == tree.end());
-                }
-            });
+        for (int i = 0; i < n_threads; ++i) {
+            REQUIRE(found[i], "case 1");
         }
 
+        // the same answers without iterators
+        driver.run([&](size_t i) {
+            for (int j = 0; j < n_numbers; j++) {
+                found[i] &= tree.contains(j) && !tree.contains(-j - 1);
+            }
+        });
+
         for (int i = 0; i < n_threads; ++i) {
-            vt[i].join();
+            REQUIRE(found[i], "case 2");
         }
     }
 
+    void throwing_insert() {
+        test_case = "throwing_insert";
+
+        consistent_tree<throwing_copy> tree;
+
+        int n_numbers = 1e3;
+        std::vector<int> n_thrown(n_threads, 0);
+        driver.run([&](size_t i) {
+            for (int j = 0; j < n_numbers; j++) {
+                int key = static_cast<int>(i) * n_numbers + j;
+                try {
+                    tree.insert(throwing_copy(j % 2 == 0 ? key : -key - 1));
+                } catch (const std::runtime_error &) {
+                    n_thrown[i]++;
+                }
+            }
+        });
+
+        // every failure reached the thread that asked for it, whoever applied it
+        for (int i = 0; i < n_threads; ++i) {
+            REQUIRE(n_thrown[i] == n_numbers / 2, "case 1");
+        }
+        REQUIRE(tree.size() == n_threads * n_numbers / 2, "case 2");
+
+        // and nothing was left locked
+        bool thrown = false;
+        try {
+            tree.insert(throwing_copy(-1));
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        tree.erase(throwing_copy(0));
+        REQUIRE(thrown && !tree.contains(throwing_copy(0)), "case 3");
+    }
+
+    void mixed_workload() {
+        test_case = "mixed_workload";
+
+        consistent_tree<int> tree;
+
+        int key_range = 1e4;
+        size_t ops_per_thread = 2e4;
+        workload_result res = driver.run_mix(tree, op_mix{50, 25, 25}, key_range, ops_per_thread);
+        REQUIRE(res.ops() == n_threads * ops_per_thread, "case 1");
+
+        // the same seeds give the same operations
+        consistent_tree<int> tree2;
+        workload_result res2 = driver.run_mix(tree2, op_mix{50, 25, 25}, key_range, ops_per_thread);
+        REQUIRE(res.n_find == res2.n_find && res.n_insert == res2.n_insert, "case 2");
+
+        auto v = tree.to_vector();
+        REQUIRE(std::is_sorted(v.begin(), v.end()), "case 3");
+        REQUIRE(v.size() == tree.size(), "case 4");
+
+        res = driver.run_mix_for(tree, op_mix{}, key_range, std::chrono::milliseconds(20));
+        REQUIRE(res.ops() > 0, "case 5");
+        REQUIRE(res.seconds >= 0.02, "case 6");
+        REQUIRE(tree.to_vector().size() == tree.size(), "case 7");
+    }
+
     void run() {
         std::cout << "--coarse_grained_test.h--\n";
         std::cout << n_threads << " threads\n";
@@ -231,12 +448,19 @@ public:
         insert_one_number();
         insert_same_numbers();
         insert_different_numbers();
+        insert_and_erase_different_numbers();
+        size_while_inserting();
+        chunked_to_vector_while_inserting();
+        read_guard_while_inserting();
+        update_while_reading();
 
         erase_same_numbers();
         erase_different_numbers();
         erase_from_different_sides();
 
         find();
+        throwing_insert();
+        mixed_workload();
 
         std::cout << test_counter - fail_counter << " TEST PASSED\n";
         std::cout << fail_counter << " TEST FAILED\n";
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <string>
+#include <thread>
+
+#include "../consistent_tree_map.h"
+#include "fail_printer.h"
+#include "../utils.h"
+
+class map_test {
+private:
+    std::string test_case;
+    size_t test_counter = 0;
+    size_t fail_counter = 0;
+
+    size_t n_threads = 0;
+
+    void REQUIRE(bool result, const std::string &reason = "") {
+        test_counter++;
+        if (!result) {
+            fail_counter++;
+            fail_printer::print("map_test.h", test_case, reason);
+        }
+    }
+
+
+    void insert_or_assign() {
+        test_case = "insert_or_assign";
+        consistent_tree_map<int, std::string> map;
+        std::map<int, std::string> m;
+
+        for (auto it: get_random_vector(1e3)) {
+            REQUIRE(map.insert_or_assign(it % 100, std::to_string(it)) == (m.count(it % 100) == 0), "case 1");
+            m[it % 100] = std::to_string(it);
+        }
+
+        REQUIRE(map.size() == m.size(), "case 2");
+        for (auto &[key, value]: m) {
+            REQUIRE(map.get(key) == value, "case 3");
+        }
+        REQUIRE(!map.get(-1), "case 4");
+
+        int expected = 0;
+        for (auto it = map.begin(); it != map.end(); ++it) {
+            REQUIRE((*it).get_ref().key == expected++, "case 5");
+        }
+    }
+
+    void try_emplace() {
+        test_case = "try_emplace";
+        consistent_tree_map<int, std::string> map;
+
+        REQUIRE(map.try_emplace(1, 3, 'a'), "case 1");
+        REQUIRE(!map.try_emplace(1, 3, 'b'), "case 2");
+        REQUIRE(map.get(1) == "aaa", "case 3");
+
+        map.erase(1);
+        REQUIRE(!map.contains(1) && map.empty(), "case 4");
+        REQUIRE(map.try_emplace(1, 2, 'c'), "case 5");
+        REQUIRE(map.get(1) == "cc", "case 6");
+    }
+
+    void subscript() {
+        test_case = "subscript";
+        consistent_tree_map<std::string, int> map;
+
+        map["a"] = 1;
+        map["b"]++;
+        map["b"]++;
+        REQUIRE(map["a"] == 1 && map["b"] == 2 && map["c"] == 0, "case 1");
+        REQUIRE(map.size() == 3, "case 2");
+    }
+
+    void erased_key_revived() {
+        test_case = "erased_key_revived";
+        consistent_tree_map<int, int> map;
+
+        map.insert_or_assign(1, 10);
+        auto pin = map.find(1);
+        map.erase(1);
+        REQUIRE(!map.update(1, [](int &v) { v++; }), "case 1");
+
+        map.insert_or_assign(1, 20);
+        REQUIRE(map.get(1) == 20, "case 2");
+        REQUIRE(map.update(1, [](int &v) { v++; }), "case 3");
+        REQUIRE(map.get(1) == 21, "case 4");
+    }
+
+    void threads_update() {
+        test_case = "threads_update";
+        consistent_tree_map<int, long long> map;
+
+        int n_keys = 10;
+        for (int i = 0; i < n_keys; ++i) {
+            map.insert_or_assign(i, 0);
+        }
+
+        std::vector<std::thread> vt(n_threads);
+        int n_updates = 1e4;
+
+        for (int i = 0; i < vt.size(); ++i) {
+            vt[i] = std::thread([&]() -> void {
+                for (int j = 0; j < n_updates; ++j) {
+                    map.update(j % n_keys, [](long long &v) { v++; });
+                    map.get((j + 1) % n_keys);
+                }
+            });
+        }
+
+        for (int i = 0; i < n_threads; ++i) {
+            vt[i].join();
+        }
+
+        for (int i = 0; i < n_keys; ++i) {
+            REQUIRE(map.get(i) == n_threads * n_updates / n_keys, "case 1");
+        }
+    }
+
+    void threads_erase_pinned() {
+        test_case = "threads_erase_pinned";
+        consistent_tree_map<int, int> map;
+
+        std::vector<std::thread> vt(n_threads);
+        int n_keys = 1e3;
+
+        for (int i = 0; i < vt.size(); ++i) {
+            vt[i] = std::thread([&](int start) -> void {
+                for (int j = start; j < start + n_keys; ++j) {
+                    map.insert_or_assign(j, j);
+                    auto it = map.find(j);
+                    map.erase(j);
+                }
+            }, n_keys * i);
+        }
+
+        for (int i = 0; i < n_threads; ++i) {
+            vt[i].join();
+        }
+
+        // unpinned tombstones queued behind another writer are freed by the next map write
+        map.insert_or_assign(-1, 0);
+        REQUIRE(map.size() == 1, "case 1");
+        REQUIRE(map.metrics().tombstones == 0, "case 2");
+    }
+
+public:
+    explicit map_test(size_t n_threads_ = 1) : n_threads(n_threads_) {}
+
+    void run() {
+        std::cout << "-------map_test.h--------\n";
+
+        insert_or_assign();
+        try_emplace();
+        subscript();
+        erased_key_revived();
+        threads_update();
+        threads_erase_pinned();
+
+        std::cout << test_counter - fail_counter << " TEST PASSED\n";
+        std::cout << fail_counter << " TEST FAILED\n";
+        std::cout << "-------------------------\n\n";
+    }
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "../sharded_tree.h"
+#include "fail_printer.h"
+#include "../utils.h"
+
+class sharded_tree_test {
+private:
+    std::string test_case;
+    size_t test_counter = 0;
+    size_t fail_counter = 0;
+
+    size_t n_threads = 0;
+
+    void REQUIRE(bool result, const std::string &reason = "") {
+        test_counter++;
+        if (!result) {
+            fail_counter++;
+            fail_printer::print("sharded_tree_test.h", test_case, reason);
+        }
+    }
+
+
+    void insert_and_erase() {
+        test_case = "insert_and_erase";
+        sharded_tree<int, 4> tree;
+        std::set<int> s;
+
+        REQUIRE(tree.begin() == tree.end(), "case 1");
+        REQUIRE(tree.empty() && !tree.front() && !tree.back(), "case 2");
+
+        for (auto it: get_random_vector(2 * 1e3, -1e3)) {
+            tree.insert(it);
+            s.insert(it);
+            REQUIRE(tree.size() == s.size(), "case 3");
+            REQUIRE(tree.front() == *s.begin(), "case 4");
+            REQUIRE(tree.back() == *s.rbegin(), "case 5");
+        }
+        REQUIRE(tree.to_vector() == set_to_vector(s), "case 6");
+
+        for (auto it: get_random_vector(1e3, -5e2)) {
+            tree.erase(it);
+            s.erase(it);
+            REQUIRE(tree.size() == s.size(), "case 7");
+        }
+        REQUIRE(tree.to_vector() == set_to_vector(s), "case 8");
+    }
+
+    void find() {
+        test_case = "find";
+        sharded_tree<int, 4> tree;
+
+        for (int i = 0; i < 1e3; i += 2) {
+            tree.insert(i);
+        }
+
+        for (int i = 0; i < 1e3; ++i) {
+            auto it = tree.find(i);
+            if (i % 2) {
+                REQUIRE(it == tree.end(), "case 1");
+                continue;
+            }
+
+            REQUIRE(it != tree.end() && *it == i, "case 2");
+            ++it;
+            if (i + 2 < 1e3) {
+                REQUIRE(it != tree.end() && *it == i + 2, "case 3");
+            } else {
+                REQUIRE(it == tree.end(), "case 4");
+            }
+        }
+    }
+
+    void threads_insert_different_numbers() {
+        test_case = "threads_insert_different_numbers";
+        sharded_tree<int, 4> tree;
+
+        std::vector<std::thread> vt(n_threads);
+        int n_numbers = 1e4;
+
+        for (int i = 0; i < vt.size(); ++i) {
+            vt[i] = std::thread([&](int start) -> void {
+                for (int j = start; j < start + n_numbers; ++j) {
+                    tree.insert(j);
+                }
+            }, n_numbers * i);
+        }
+
+        for (int i = 0; i < n_threads; ++i) {
+            vt[i].join();
+        }
+
+        REQUIRE(tree.size() == n_threads * n_numbers, "case 1");
+
+        int expected = 0;
+        bool sorted = true;
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+            sorted &= *it == expected++;
+        }
+        REQUIRE(sorted && expected == n_threads * n_numbers, "case 2");
+    }
+
+public:
+    explicit sharded_tree_test(size_t n_threads_ = 1) : n_threads(n_threads_) {}
+
+    void run() {
+        std::cout << "---sharded_tree_test.h---\n";
+
+        insert_and_erase();
+        find();
+        threads_insert_different_numbers();
+
+        std::cout << test_counter - fail_counter << " TEST PASSED\n";
+        std::cout << fail_counter << " TEST FAILED\n";
+        std::cout << "-------------------------\n\n";
+    }
+};
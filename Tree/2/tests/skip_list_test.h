@@ -0,0 +1,308 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <set>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "../consistent_skip_list.h"
+#include "fail_printer.h"
+#include "../utils.h"
+
+class skip_list_test {
+private:
+    std::string test_case;
+    size_t test_counter = 0;
+    size_t fail_counter = 0;
+
+    size_t n_threads = 0;
+
+    void REQUIRE(bool result, const std::string &reason = "") {
+        test_counter++;
+        if (!result) {
+            fail_counter++;
+            fail_printer::print("skip_list_test.h", test_case, reason);
+        }
+    }
+
+
+    void insert_and_erase() {
+        test_case = "insert_and_erase";
+        std::vector<std::vector<int>> tests = {
+                {},
+                {-100, 100},
+                {3, -1, 30, 400, -11, 55, 1203},
+                get_random_vector(10),
+                get_random_vector(1e3),
+                get_random_vector(1e3)
+        };
+        int n_test = 1;
+        for (auto &test: tests) {
+            consistent_skip_list<int> list;
+            std::set<int> s;
+
+            for (auto it: test) {
+                list.insert(it);
+                s.insert(it);
+                REQUIRE(list.find(it) != list.end(), "case 1, test " + std::to_string(n_test));
+                REQUIRE(list.find(-it - 1) == list.end(), "case 2, test " + std::to_string(n_test));
+            }
+            REQUIRE(list.to_vector() == set_to_vector(s), "case 3, test " + std::to_string(n_test));
+            REQUIRE(list.size() == s.size(), "case 4, test " + std::to_string(n_test));
+
+            for (auto it: get_random_vector(4 * 1e3, -2e3)) {
+                list.erase(it);
+                s.erase(it);
+                REQUIRE(list.find(it) == list.end(), "case 5, test " + std::to_string(n_test));
+                REQUIRE(list.size() == s.size(), "case 6, test " + std::to_string(n_test));
+            }
+            REQUIRE(list.empty(), "case 7, test " + std::to_string(n_test));
+
+            n_test++;
+        }
+    }
+
+    void front_and_back() {
+        test_case = "front_and_back";
+        consistent_skip_list<int> list;
+        REQUIRE(!list.front() && !list.back(), "case 1");
+
+        std::set<int> s;
+        for (auto it: get_random_vector(2 * 1e3, -1e3)) {
+            list.insert(it);
+            s.insert(it);
+            REQUIRE(list.front() == *s.begin(), "case 2");
+            REQUIRE(list.back() == *s.rbegin(), "case 3");
+        }
+
+        for (int i = -1e3; i < 1e3 - 1; ++i) {
+            list.erase(i);
+            REQUIRE(list.front() == i + 1, "case 4");
+            REQUIRE(list.back() == 1e3 - 1, "case 5");
+        }
+
+        list.erase(1e3 - 1);
+        REQUIRE(list.empty() && !list.front() && !list.back(), "case 6");
+    }
+
+    void iterator() {
+        test_case = "iterator";
+        consistent_skip_list<int> list;
+
+        REQUIRE(list.begin() == list.end(), "case 1");
+
+        auto v = get_random_vector(1e3);
+        for (auto it: v) {
+            list.insert(it);
+        }
+
+        int expected = 0;
+        for (auto it = list.begin(); it != list.end(); ++it) {
+            REQUIRE((*it).get() == expected++, "case 2");
+        }
+        REQUIRE(expected == v.size(), "case 3");
+
+        auto it = list.end();
+        for (expected = (int) v.size() - 1; expected >= 0; --expected) {
+            REQUIRE((*--it).get() == expected, "case 4");
+        }
+        REQUIRE(--it == list.end(), "case 5");
+    }
+
+    void iterator_erased() {
+        test_case = "iterator_erased";
+        consistent_skip_list<int> list;
+        for (int i = 1; i <= 5; ++i) {
+            list.insert(i);
+        }
+
+        auto it1 = list.find(1);
+        auto it2 = list.find(2);
+        auto it3 = list.find(3);
+        auto it4 = list.find(4);
+        auto it5 = list.find(5);
+
+        list.erase(it2);
+        list.erase(it3);
+        list.erase(it5);
+
+        REQUIRE((*it2).get() == 2, "case 1");
+        REQUIRE(list.size() == 2, "case 2");
+
+        // keep erasing around the pinned nodes to make the list reclaim memory
+        for (int i = 100; i < 100 + 2 * consistent_skip_list<int>::RECLAIM_THRESHOLD; ++i) {
+            list.insert(i);
+            list.erase(i);
+        }
+
+        REQUIRE((*it3).get() == 3, "case 3");
+        REQUIRE(++it1 == it4, "case 4");
+        REQUIRE(++it2 == it4, "case 5");
+        REQUIRE(--it5 == it4, "case 6");
+        REQUIRE(--it3 == list.find(1), "case 7");
+        REQUIRE(++it4 == list.end(), "case 8");
+
+        // a stale iterator doesn't erase the key inserted again
+        auto stale = list.find(4);
+        REQUIRE(list.erase(stale), "case 9");
+        list.insert(4);
+        REQUIRE(!list.erase(stale) && list.find(4) != list.end(), "case 10");
+        REQUIRE(list.erase(list.find(4)) && list.find(4) == list.end(), "case 11");
+    }
+
+    void destructor() {
+        test_case = "destructor";
+        auto *receiver1 = new receiver();
+
+        auto *list1 = new consistent_skip_list<int>(receiver1);
+        delete list1;
+        REQUIRE(receiver1->value == 2, "case 1");
+
+        receiver1->value = 0;
+        auto *list2 = new consistent_skip_list<int>(receiver1);
+        int size = 1e3;
+        auto v = get_random_vector(size);
+        for (int i = 0; i < size; ++i) {
+            list2->insert(v[i]);
+            if (i % 2) {
+                list2->erase(v[i]);
+            }
+        }
+        delete list2;
+        REQUIRE(receiver1->value == size + 2, "case 2");
+
+        delete receiver1;
+    }
+
+    void threads_insert_and_erase() {
+        test_case = "threads_insert_and_erase";
+        consistent_skip_list<int> list;
+
+        std::vector<std::thread> vt(n_threads);
+        int n_numbers = 1e4;
+
+        for (int i = 0; i < vt.size(); ++i) {
+            vt[i] = std::thread([&](int start) -> void {
+                for (int j = start; j < start + n_numbers; ++j) {
+                    list.insert(j);
+                    if (j % 2) {
+                        list.erase(j);
+                    }
+                }
+            }, n_numbers * i);
+        }
+
+        for (int i = 0; i < n_threads; ++i) {
+            vt[i].join();
+        }
+
+        REQUIRE(list.size() == n_threads * n_numbers / 2, "case 1");
+        for (int i = 0; i < n_threads * n_numbers; ++i) {
+            REQUIRE((list.find(i) != list.end()) == (i % 2 == 0), "case 2");
+        }
+    }
+
+    void threads_iterate_while_erase() {
+        test_case = "threads_iterate_while_erase";
+        consistent_skip_list<int> list;
+
+        int n_numbers = 1e4;
+        for (int i = 0; i < n_numbers; ++i) {
+            list.insert(i);
+        }
+
+        std::vector<std::thread> vt(n_threads);
+        std::vector<char> sorted(n_threads, true);
+        for (int i = 0; i < vt.size(); ++i) {
+            vt[i] = std::thread([&](int i) -> void {
+                if (i == 0) {
+                    for (int j = 0; j < n_numbers; ++j) {
+                        list.erase(j);
+                    }
+                    return;
+                }
+
+                int prev = -1;
+                for (auto it = list.begin(); it != list.end(); ++it) {
+                    int value = (*it).get();
+                    sorted[i] &= prev < value;
+                    prev = value;
+                }
+            }, i);
+        }
+
+        for (int i = 0; i < n_threads; ++i) {
+            vt[i].join();
+            REQUIRE(sorted[i], "case 1");
+        }
+
+        REQUIRE(list.empty(), "case 2");
+    }
+
+    void threads_find_while_erase() {
+        test_case = "threads_find_while_erase";
+        using list_t = consistent_skip_list<int>;
+        list_t list;
+
+        int n_numbers = 1e4;
+        for (int i = 0; i < n_numbers; ++i) {
+            list.insert(i);
+        }
+
+        std::atomic<bool> done = false;
+        size_t max_retired = 0;
+        std::vector<std::thread> vt(n_threads + 1);
+        for (int i = 0; i < vt.size(); ++i) {
+            vt[i] = std::thread([&](int i) -> void {
+                if (i == 0) {
+                    for (int j = 0; j < n_numbers; ++j) {
+                        list.erase(j);
+                        max_retired = std::max(max_retired, list.retired());
+                    }
+                    done = true;
+                    return;
+                }
+
+                while (!done) {
+                    for (int j = n_numbers - 1; j >= 0 && !done; j -= 7) {
+                        list.find(j);
+                    }
+                }
+            }, i);
+        }
+
+        for (auto &t: vt) {
+            t.join();
+        }
+
+        // readers pin at most one node each
+        REQUIRE(max_retired <= list_t::RECLAIM_LIMIT + n_threads, "case 1");
+        REQUIRE(list.empty(), "case 2");
+    }
+
+public:
+    explicit skip_list_test(size_t n_threads_ = 1) : n_threads(n_threads_) {}
+
+    void run() {
+        std::cout << "-----skip_list_test.h-----\n";
+
+        insert_and_erase();
+        front_and_back();
+
+        iterator();
+        iterator_erased();
+
+        destructor();
+
+        threads_insert_and_erase();
+        threads_iterate_while_erase();
+        threads_find_while_erase();
+
+        std::cout << test_counter - fail_counter << " TEST PASSED\n";
+        std::cout << fail_counter << " TEST FAILED\n";
+        std::cout << "-------------------------\n\n";
+    }
+};
@@ -5,11 +5,47 @@
 #include <set>
 #include <string>
 #include <algorithm>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <string_view>
+#include <cmath>
+#include <numeric>
 
 #include "../consistent_tree.h"
 #include "fail_printer.h"
 #include "../utils.h"
 
+// ordered by key only, the payload can only be moved
+struct move_only_value {
+    int key = 0;
+    std::unique_ptr<int> payload;
+
+    move_only_value() = default;
+
+    explicit move_only_value(int key_) : key(key_), payload(new int(key_)) {}
+
+    move_only_value(move_only_value &&) = default;
+
+    move_only_value &operator=(move_only_value &&) = default;
+
+    bool operator<(const move_only_value &rhs) const { return key < rhs.key; }
+
+    bool operator>(const move_only_value &rhs) const { return key > rhs.key; }
+
+    bool operator==(const move_only_value &rhs) const { return key == rhs.key; }
+};
+
+// std::less that counts its calls
+struct counting_less {
+    size_t *counter;
+
+    bool operator()(int lhs, int rhs) const {
+        ++*counter;
+        return lhs < rhs;
+    }
+};
+
 class tree_test {
 private:
     std::string test_case;
@@ -558,6 +594,852 @@ private:
     }
 
 
+    void order_statistics() {
+        test_case = "order_statistics";
+        consistent_tree<int> tree;
+        std::set<int> s;
+
+        REQUIRE(tree.nth(0) == tree.end(), "case 1");
+        REQUIRE(tree.rank(0) == 0, "case 2");
+
+        auto v = get_random_vector(1e3);
+        for (auto it: v) {
+            tree.insert(it);
+            s.insert(it);
+        }
+
+        std::vector<typename consistent_tree<int>::iterator> pinned;
+        for (int i = 0; i < v.size() / 2; ++i) {
+            if (i % 2) {
+                pinned.push_back(tree.find(v[i]));
+            }
+            tree.erase(v[i]);
+            s.erase(v[i]);
+        }
+        for (int i = 0; i < 100; ++i) {
+            tree.insert(v[i]);
+            s.insert(v[i]);
+        }
+
+        auto sv = set_to_vector(s);
+        for (int k = 0; k < sv.size(); ++k) {
+            REQUIRE((*tree.nth(k)).get() == sv[k], "case 3");
+        }
+        REQUIRE(tree.nth(sv.size()) == tree.end(), "case 4");
+
+        for (int i = -1; i <= 1e3; ++i) {
+            size_t expected = std::distance(s.begin(), s.lower_bound(i));
+            REQUIRE(tree.rank(i) == expected, "case 5");
+        }
+
+        for (int i = 0; i < 100; ++i) {
+            int lo = v[i], hi = v[v.size() - i - 1];
+            size_t expected = lo < hi ? std::distance(s.lower_bound(lo), s.lower_bound(hi)) : 0;
+            REQUIRE(tree.count_range(lo, hi) == expected, "case 6");
+        }
+    }
+
+    void move_only() {
+        test_case = "move_only";
+        consistent_tree<move_only_value> tree;
+
+        REQUIRE(!tree.front_guard(), "case 1");
+
+        auto v = get_random_vector(1e3);
+        for (int i = 0; i < v.size(); ++i) {
+            if (i % 2) {
+                tree.insert(move_only_value(v[i]));
+            } else {
+                tree.emplace(v[i]);
+            }
+        }
+        REQUIRE(tree.size() == v.size(), "case 2");
+
+        for (int i = 0; i < v.size(); ++i) {
+            auto it = tree.find(move_only_value(i));
+            REQUIRE(it != tree.end(), "case 3");
+            REQUIRE(*(*it).get_ref().payload == i, "case 4");
+        }
+
+        auto front = tree.front_guard();
+        REQUIRE(front && front->key == 0 && *front->payload == 0, "case 5");
+
+        tree.erase(move_only_value(0));
+        REQUIRE(*front->payload == 0, "case 6");
+        REQUIRE(tree.front_guard()->key == 1, "case 7");
+        REQUIRE(tree.back_guard()->key == v.size() - 1, "case 8");
+
+        for (int i = 0; i < v.size(); ++i) {
+            tree.erase(tree.find(move_only_value(i)));
+        }
+        REQUIRE(tree.empty() && !tree.back_guard(), "case 9");
+    }
+
+    void value_access() {
+        test_case = "value_access";
+        consistent_tree<move_only_value> tree;
+        for (int i = 0; i < 10; ++i) {
+            tree.emplace(i);
+        }
+
+        auto it = tree.find(move_only_value(3));
+        REQUIRE(it.value().key == 3 && *it->payload == 3, "case 1");
+        REQUIRE(&it.value() == &(*it).get_ref(), "case 2");
+
+        (*it).update([](move_only_value &value_) { *value_.payload = 42; });
+        REQUIRE(*it->payload == 42 && *tree.find(move_only_value(3))->payload == 42, "case 3");
+
+        consistent_tree<int> ints;
+        ints.insert(1);
+        auto int_it = ints.begin();
+        (*int_it).set(1);
+        REQUIRE((*int_it).get() == 1 && *int_it.operator->() == 1, "case 4");
+    }
+
+    void comparator() {
+        test_case = "comparator";
+        consistent_tree<int, std::greater<int>> tree;
+        auto v = get_random_vector(1e3);
+        for (auto it: v) {
+            tree.insert(it);
+        }
+        for (int i = 0; i < 1e3; i += 2) {
+            tree.erase(i);
+        }
+
+        std::vector<int> expected;
+        for (int i = 999; i >= 0; i -= 2) {
+            expected.push_back(i);
+        }
+        REQUIRE(tree.to_vector() == expected, "case 1");
+        REQUIRE(tree.front() == 999 && tree.back() == 1, "case 2");
+        REQUIRE((*tree.lower_bound(500)).get() == 499, "case 3");
+        REQUIRE(tree.rank(500) == 250, "case 4");
+        REQUIRE(tree.find(500) == tree.end() && tree.find(501) != tree.end(), "case 5");
+
+        auto it = tree.end();
+        REQUIRE((*--it).get() == 1, "case 6");
+    }
+
+    void transparent_comparator() {
+        test_case = "transparent_comparator";
+        consistent_tree<std::string, std::less<>> tree;
+        for (auto &it: {"b", "d", "a", "c"}) {
+            tree.insert(it);
+        }
+        tree.erase("c");
+
+        REQUIRE(tree.find(std::string_view("a")) != tree.end(), "case 1");
+        REQUIRE(tree.find(std::string_view("c")) == tree.end(), "case 2");
+        REQUIRE((*tree.lower_bound(std::string_view("bb"))).get() == "d", "case 3");
+        REQUIRE(tree.rank(std::string_view("c")) == 2, "case 4");
+        REQUIRE(tree.count_range(std::string_view("a"), std::string_view("z")) == 3, "case 5");
+        REQUIRE(tree.contains(std::string_view("b")) && tree.count(std::string_view("c")) == 0, "case 6");
+        REQUIRE(tree.try_get(std::string_view("d")) == "d" && tree.lower_bound_value(std::string_view("bb")) == "d",
+                "case 7");
+    }
+
+    void comparisons_per_find() {
+        test_case = "comparisons_per_find";
+        size_t counter = 0;
+        consistent_tree<int, counting_less> tree(counting_less{&counter});
+        int size = 1e3;
+        for (auto it: get_random_vector(size)) {
+            tree.insert(it);
+        }
+
+        // one comparison per level and one more to check equality
+        size_t max_comparisons = tree.get_height(tree.HEAD_NODE->get_right()) + 1;
+        for (int i = -1; i <= size; ++i) {
+            counter = 0;
+            tree.find(i);
+            REQUIRE(counter <= max_comparisons, "case 1");
+        }
+    }
+
+    void parallel_to_vector() {
+        test_case = "parallel_to_vector";
+        thread_pool pool(4);
+        consistent_tree<int> tree;
+        REQUIRE(tree.to_vector(pool).empty(), "case 1");
+
+        int size = 1e5;
+        for (auto it: get_random_vector(size)) {
+            tree.insert(it);
+        }
+
+        // pinned erased nodes stay in the tree as tombstones
+        std::vector<typename consistent_tree<int>::iterator> pinned;
+        std::vector<int> expected;
+        for (int i = 0; i < size; ++i) {
+            if (i % 3 == 0) {
+                expected.push_back(i);
+                continue;
+            }
+            if (i % 3 == 1) {
+                pinned.push_back(tree.find(i));
+            }
+            tree.erase(i);
+        }
+
+        auto v = tree.to_vector(pool);
+        REQUIRE(v == expected, "case 2");
+        REQUIRE(v == tree.to_vector(), "case 3");
+    }
+
+    void chunked_to_vector() {
+        test_case = "chunked_to_vector";
+        consistent_tree<int> tree;
+        for (auto it: get_random_vector(1e3)) {
+            tree.insert(it);
+        }
+        for (int i = 0; i < 1e3; i += 2) {
+            tree.erase(i);
+        }
+        auto expected = tree.to_vector();
+
+        for (size_t chunk_size: {1, 7, 100, 500, 1000}) {
+            std::vector<int> v;
+            bool small_chunks = true;
+            tree.to_vector_chunked(chunk_size, [&](const std::vector<int> &chunk) {
+                small_chunks &= !chunk.empty() && chunk.size() <= chunk_size;
+                v.insert(v.end(), chunk.begin(), chunk.end());
+            });
+            REQUIRE(small_chunks, "case 1, chunk_size " + std::to_string(chunk_size));
+            REQUIRE(v == expected, "case 2, chunk_size " + std::to_string(chunk_size));
+        }
+    }
+
+    void bulk_algorithms() {
+        test_case = "bulk_algorithms";
+        using namespace consistent_execution;
+        thread_pool pool(4);
+        consistent_tree<int> tree;
+
+        REQUIRE(tree.count_if(par(pool), [](int) { return true; }) == 0, "case 1");
+
+        int size = 1e5;
+        for (auto it: get_random_vector(size)) {
+            tree.insert(it);
+        }
+        std::vector<typename consistent_tree<int>::iterator> pinned;
+        for (int i = 0; i < size; i += 2) {
+            if (i % 4 == 0) {
+                pinned.push_back(tree.find(i));
+            }
+            tree.erase(i);
+        }
+
+        std::atomic<long long> sum = 0;
+        tree.for_each(par(pool), [&sum](int value) { sum += value; });
+        long long expected_sum = (long long) size * size / 4;
+        REQUIRE(sum == expected_sum, "case 2");
+
+        sum = 0;
+        tree.for_each([&sum](int value) { sum += value; });
+        REQUIRE(sum == expected_sum, "case 3");
+
+        auto plus = [](long long a, long long b) { return a + b; };
+        auto identity = [](int value) { return (long long) value; };
+        REQUIRE(tree.transform_reduce(par(pool), 0LL, plus, identity) == expected_sum, "case 4");
+        REQUIRE(tree.transform_reduce(seq, 0LL, plus, identity) == expected_sum, "case 5");
+
+        // concatenation isn't commutative, so this checks that parts are reduced in order
+        auto concat = [](std::vector<int> a, const std::vector<int> &b) {
+            a.insert(a.end(), b.begin(), b.end());
+            return a;
+        };
+        auto single = [](int value) { return std::vector<int>{value}; };
+        REQUIRE(tree.transform_reduce(par(pool), std::vector<int>(), concat, single) == tree.to_vector(), "case 6");
+
+        auto divisible_by_3 = [](int value) { return value % 3 == 0; };
+        size_t expected_count = 0;
+        for (int i = 1; i < size; i += 2) {
+            expected_count += i % 3 == 0;
+        }
+        REQUIRE(tree.count_if(par(pool), divisible_by_3) == expected_count, "case 7");
+        REQUIRE(tree.count_if(divisible_by_3) == expected_count, "case 8");
+    }
+
+    void latency_histogram_buckets() {
+        test_case = "latency_histogram_buckets";
+        latency_histogram h;
+        for (uint64_t value = 0; value < 1e5; ++value) {
+            uint64_t lower = latency_histogram::bucket_value(latency_histogram::bucket(value));
+            // a bucket is at most 1/SUB_BUCKETS of its value wide
+            REQUIRE(lower <= value && value - lower <= value / latency_histogram::SUB_BUCKETS, "case 1");
+
+            size_t i = latency_histogram::bucket(value);
+            h.counts[i]++;
+            h.count++;
+            h.sum += value;
+            h.max = std::max(h.max, value);
+        }
+        REQUIRE(latency_histogram::bucket(uint64_t(-1)) == latency_histogram::N_BUCKETS - 1, "case 2");
+
+        uint64_t p50 = h.percentile(0.5);
+        REQUIRE(p50 <= 5e4 && p50 >= 5e4 - 5e4 / latency_histogram::SUB_BUCKETS, "case 3");
+        REQUIRE(h.percentile(1) == h.max && h.percentile(0) == 0, "case 4");
+        REQUIRE(latency_histogram().percentile(0.5) == 0, "case 5");
+    }
+
+    void stats() {
+        test_case = "stats";
+        consistent_tree<int> tree;
+        for (int i = 0; i < 100; ++i) {
+            tree.insert(i);
+        }
+        for (int i = 0; i < 50; ++i) {
+            tree.erase(i);
+            tree.find(i);
+        }
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+        }
+
+        container_stats stats = tree.stats();
+#ifdef CONSISTENT_STATS
+        REQUIRE(stats[stats_op::INSERT].count == 100, "case 1");
+        REQUIRE(stats[stats_op::ERASE].count == 50, "case 2");
+        REQUIRE(stats[stats_op::FIND].count == 50, "case 3");
+        REQUIRE(stats[stats_op::ITERATE].count == 50, "case 4");
+        REQUIRE(stats[stats_op::LOCK_WAIT].count >= 150, "case 5");
+        REQUIRE(stats[stats_op::INSERT].max >= stats[stats_op::INSERT].percentile(0.5), "case 6");
+#else
+        REQUIRE(stats[stats_op::INSERT].count == 0, "case 1");
+#endif
+    }
+
+    void lock_profiling() {
+        test_case = "lock_profiling";
+        consistent_tree<int> tree;
+        for (int i = 0; i < 100; ++i) {
+            tree.insert(i);
+        }
+        for (int i = 0; i < 50; ++i) {
+            tree.find(i);
+        }
+        tree.begin();
+
+        lock_stats_snapshot stats = tree.lock_stats();
+#ifdef CONSISTENT_LOCK_PROFILING
+        const lock_site_stats *insert = stats.find("insert");
+        const lock_site_stats *find = stats.find("find");
+        REQUIRE(insert != nullptr && insert->exclusive.acquisitions == 100, "case 1");
+        REQUIRE(insert->shared.acquisitions == 0, "case 2");
+        REQUIRE(find != nullptr && find->shared.acquisitions == 50, "case 3");
+        REQUIRE(find->shared.max_hold_ns <= find->shared.total_hold_ns, "case 4");
+        REQUIRE(stats.find("begin") != nullptr && stats.find("erase") == nullptr, "case 5");
+#else
+        REQUIRE(stats.sites.empty(), "case 1");
+#endif
+    }
+
+    void metrics() {
+        test_case = "metrics";
+        consistent_tree<int> tree;
+        for (int i = 0; i < 100; ++i) {
+            tree.insert(i);
+        }
+
+        container_metrics m = tree.metrics();
+        REQUIRE(m.rotations > 0 && m.rebalances > 0 && m.rebalances <= m.rotations, "case 1");
+        REQUIRE(m.height > 0 && m.height <= m.max_height, "case 2");
+        REQUIRE(m.tombstones == 0 && m.pinned_nodes == 0 && m.frees == 0, "case 3");
+
+        {
+            auto it_1 = tree.find(10);
+            auto it_2 = tree.find(10);
+            auto it_3 = tree.find(20);
+            REQUIRE(tree.metrics().pinned_nodes == 2, "case 4");
+
+            tree.erase(10);
+            tree.erase(30);
+            m = tree.metrics();
+            REQUIRE(m.tombstones == 1 && m.frees == 1, "case 5");
+        }
+
+        container_metrics after = tree.metrics();
+        REQUIRE(after.tombstones == 0 && after.pinned_nodes == 0 && after.frees == 2, "case 6");
+        REQUIRE(after.frees_per_second(m) >= 0, "case 7");
+    }
+
+    void read_guard() {
+        test_case = "read_guard";
+        consistent_tree<int> tree;
+        for (int i = 0; i < 100; i += 2) {
+            tree.insert(i);
+        }
+        tree.erase(10);
+
+        consistent_tree<int>::iterator pinned;
+        {
+            auto guard = tree.read();
+            std::vector<int> v;
+            for (auto it = guard.begin(); it != guard.end(); ++it) {
+                v.push_back(*it);
+            }
+            REQUIRE(v == tree.to_vector() && v.size() == guard.size(), "case 1");
+            REQUIRE(tree.metrics().pinned_nodes == 0, "case 2");
+
+            REQUIRE(*guard.find(20) == 20 && guard.find(10) == guard.end(), "case 3");
+            REQUIRE(guard.find(21) == guard.end(), "case 4");
+            REQUIRE(*guard.lower_bound(9) == 12, "case 5");
+            REQUIRE(guard.lower_bound(99) == guard.end(), "case 6");
+
+            auto it = guard.lower_bound(40);
+            --it;
+            REQUIRE(*it == 38, "case 7");
+            pinned = guard.pin(it);
+        }
+
+        tree.erase(38);
+        REQUIRE((*pinned).get() == 38, "case 8");
+        REQUIRE((*++pinned).get() == 40, "case 9");
+    }
+
+    void erase_by_iterator() {
+        test_case = "erase_by_iterator";
+        size_t counter = 0;
+        consistent_tree<int, counting_less> tree(counting_less{&counter});
+        std::set<int> s;
+        for (auto it: get_random_vector(1e3)) {
+            tree.insert(it);
+            s.insert(it);
+        }
+
+        // an expiry sweep: neither marking nor freeing the node compares values
+        counter = 0;
+        for (auto it = tree.begin(); it != tree.end();) {
+            auto current = it;
+            ++it;
+            if ((*current).get() % 3 == 0) {
+                s.erase((*current).get());
+                tree.erase(current);
+            }
+        }
+        REQUIRE(counter == 0, "case 1");
+        REQUIRE(tree.to_vector() == std::vector<int>(s.begin(), s.end()), "case 2");
+        REQUIRE(tree.size() == s.size() && tree.n_deleted_node >= 1, "case 3");
+
+        // counts and balance survive the removals
+        size_t i = 0;
+        for (auto it: s) {
+            REQUIRE((*tree.nth(i)).get() == it && tree.rank(it) == i, "case 4");
+            i++;
+        }
+        REQUIRE(tree.get_height(tree.HEAD_NODE->get_right()) <= 1.45 * std::log2(s.size() + 2), "case 5");
+
+        tree.erase(tree.end());
+        REQUIRE(tree.size() == s.size(), "case 6");
+    }
+
+    void front_back_cached() {
+        test_case = "front_back_cached";
+        size_t counter = 0;
+        consistent_tree<int, counting_less> tree(counting_less{&counter});
+        std::set<int> s;
+        std::vector<typename consistent_tree<int, counting_less>::iterator> pinned;
+        auto v = get_random_vector(2 * 1e3, -1e3);
+        for (size_t i = 0; i < v.size(); i++) {
+            if (i % 3 == 2 && s.size() >= 2) {
+                // pinned tombstones at either end must be skipped
+                pinned.push_back(tree.find(*s.begin()));
+                pinned.push_back(tree.find(*s.rbegin()));
+                tree.erase(*s.begin());
+                tree.erase(*s.rbegin());
+                s.erase(s.begin());
+                s.erase(std::prev(s.end()));
+            } else {
+                tree.insert(v[i]);
+                s.insert(v[i]);
+            }
+            if (s.empty()) {
+                REQUIRE(tree.begin() == tree.end(), "case 1");
+                continue;
+            }
+            REQUIRE(tree.front() == *s.begin() && tree.back() == *s.rbegin(), "case 2");
+            REQUIRE((*tree.begin()).get() == *s.begin(), "case 3");
+        }
+
+        // no descent from the root
+        counter = 0;
+        tree.front();
+        tree.back();
+        tree.begin();
+        REQUIRE(counter == 0, "case 4");
+
+        // an erased end revived by insert
+        int min = *s.begin();
+        tree.erase(min);
+        tree.insert(min);
+        REQUIRE(tree.front() == min, "case 5");
+
+        consistent_tree<int, counting_less> copy(tree);
+        auto copied = copy.to_vector();
+        REQUIRE(copy.front() == copied.front() && copy.back() == copied.back(), "case 6");
+
+        tree.clear();
+        REQUIRE(tree.begin() == tree.end() && !tree.front_guard() && !tree.back_guard(), "case 7");
+        REQUIRE(!tree.front() && !tree.back(), "case 8");
+        tree.insert(5);
+        REQUIRE(tree.front() == 5 && tree.back() == 5, "case 9");
+    }
+
+    // the in-order ring must match the tree shape after rotations and removals
+    void threaded_links() {
+        test_case = "threaded_links";
+        consistent_tree<int> tree;
+        using node = typename consistent_tree<int>::node;
+        std::vector<typename consistent_tree<int>::iterator> pinned;
+        auto v = get_random_vector(3 * 1e3, -1e3);
+        for (size_t i = 0; i < v.size(); i++) {
+            tree.insert(v[i]);
+            if (i % 3 == 1) {
+                pinned.push_back(tree.find(v[i - 1]));
+                tree.erase(v[i - 1]);
+            } else if (i % 3 == 2) {
+                tree.erase(v[i - 1]);
+            }
+            if (i % 5 == 0 && !pinned.empty()) {
+                pinned.erase(pinned.begin());
+            }
+        }
+
+        std::vector<node *> in_order;
+        std::function<void(node *)> walk = [&](node *node_) {
+            if (node_ != nullptr) {
+                walk(node_->get_left());
+                in_order.push_back(node_);
+                walk(node_->get_right());
+            }
+        };
+        walk(tree.HEAD_NODE->get_right());
+
+        std::vector<node *> forward, backward;
+        for (node *node_ = tree.HEAD_NODE->get_next(); node_ != tree.HEAD_NODE; node_ = node_->get_next()) {
+            forward.push_back(node_);
+        }
+        for (node *node_ = tree.HEAD_NODE->get_prev(); node_ != tree.HEAD_NODE; node_ = node_->get_prev()) {
+            backward.push_back(node_);
+        }
+        std::reverse(backward.begin(), backward.end());
+        REQUIRE(forward == in_order, "case 1");
+        REQUIRE(backward == in_order, "case 2");
+
+        pinned.clear();
+        tree.clear();
+        REQUIRE(tree.HEAD_NODE->get_next() == tree.HEAD_NODE && tree.HEAD_NODE->get_prev() == tree.HEAD_NODE,
+                "case 3");
+    }
+
+    void hinted_insert() {
+        test_case = "hinted_insert";
+        size_t counter = 0;
+        consistent_tree<int, counting_less> tree(counting_less{&counter});
+
+        // increasing keys append next to the maximum without a search
+        int N = 1e4;
+        for (int i = 0; i < N; i += 2) {
+            tree.insert(i);
+        }
+        REQUIRE(counter <= 3 * N / 2, "case 1");
+
+        // odd keys right before their successor
+        counter = 0;
+        for (int i = 1; i < N; i += 2) {
+            tree.insert(tree.find(i + 1), i);
+        }
+        tree.insert(tree.end(), N);
+        REQUIRE(tree.size() == N + 1, "case 2");
+
+        std::vector<int> expected(N + 1);
+        std::iota(expected.begin(), expected.end(), 0);
+        REQUIRE(tree.to_vector() == expected, "case 3");
+        for (int i = 0; i <= N; i += 97) {
+            REQUIRE((*tree.nth(i)).get() == i && tree.rank(i) == i, "case 4");
+        }
+        REQUIRE(tree.get_height(tree.HEAD_NODE->get_right()) <= 1.45 * std::log2(N + 3), "case 5");
+
+        // wrong hints, equal keys and erased keys still end up in order
+        tree.insert(tree.begin(), N + 5);
+        tree.insert(tree.find(3), 3);
+        tree.erase(7);
+        tree.insert(tree.find(8), 7);
+        tree.insert(tree.end(), -1);
+        REQUIRE(tree.size() == N + 3 && tree.front() == -1 && tree.back() == N + 5, "case 6");
+        REQUIRE(tree.find(7) != tree.end() && tree.rank(7) == 8, "case 7");
+
+        consistent_tree<move_only_value> moved;
+        moved.insert(moved.end(), move_only_value(1));
+        moved.insert(moved.end(), move_only_value(0));
+        REQUIRE(moved.begin()->key == 0 && moved.size() == 2, "case 8");
+    }
+
+    // parents, heights, counts, balance and the in-order ring all agree
+    template<typename Tree>
+    bool is_well_formed(Tree &tree) {
+        using node = typename Tree::node;
+        std::vector<node *> in_order;
+        bool ok = true;
+        std::function<int(node *, node *)> check = [&](node *node_, node *parent) -> int {
+            if (node_ == nullptr) {
+                return 0;
+            }
+            ok = ok && node_->get_parent() == parent && node_->tree == &tree;
+            int lh = check(node_->get_left(), node_);
+            in_order.push_back(node_);
+            int rh = check(node_->get_right(), node_);
+            size_t count = tree.get_count(node_->get_left()) + tree.get_count(node_->get_right()) +
+                           (node_->is_deleted() ? 0 : 1);
+            ok = ok && std::abs(lh - rh) <= 1 && node_->get_height() == std::max(lh, rh) + 1 &&
+                 node_->get_count() == count;
+            return std::max(lh, rh) + 1;
+        };
+        check(tree.HEAD_NODE->get_right(), tree.HEAD_NODE);
+
+        std::vector<node *> ring;
+        for (node *node_ = tree.HEAD_NODE->get_next(); node_ != tree.HEAD_NODE; node_ = node_->get_next()) {
+            ok = ok && node_->get_next()->get_prev() == node_;
+            ring.push_back(node_);
+        }
+        return ok && ring == in_order && tree.size() == tree.get_count(tree.HEAD_NODE->get_right());
+    }
+
+    void split_join() {
+        test_case = "split_join";
+        size_t counter = 0;
+        consistent_tree<int, counting_less> tree(counting_less{&counter});
+        int N = 1e4;
+        auto v = get_random_vector(N);
+        std::set<int> s(v.begin(), v.end());
+        for (auto it: v) {
+            tree.insert(it);
+        }
+
+        for (int key: {-1, N / 3, N / 2, N}) {
+            consistent_tree<int, counting_less> greater(counting_less{&counter});
+            counter = 0;
+            REQUIRE(tree.split(key, greater), "case 1");
+            REQUIRE(counter <= 2 * tree.get_height(tree.HEAD_NODE->get_right()) + 2 * std::log2(N) + 4,
+                    "case 2");
+            REQUIRE(tree.to_vector() == std::vector<int>(s.begin(), s.lower_bound(key)), "case 3");
+            REQUIRE(greater.to_vector() == std::vector<int>(s.lower_bound(key), s.end()), "case 4");
+            REQUIRE(is_well_formed(tree) && is_well_formed(greater), "case 5");
+            if (!greater.empty()) {
+                REQUIRE(greater.front() == *s.lower_bound(key) && (*greater.nth(0)).get() == greater.front(),
+                        "case 6");
+            }
+
+            REQUIRE(tree.join(greater), "case 7");
+            REQUIRE(greater.empty() && tree.to_vector() == std::vector<int>(s.begin(), s.end()), "case 8");
+            REQUIRE(is_well_formed(tree) && is_well_formed(greater), "case 9");
+        }
+
+        // an iterator on a node that would move blocks the split, one on a node that stays doesn't
+        consistent_tree<int, counting_less> greater(counting_less{&counter});
+        int low = *s.begin();
+        int high = *s.rbegin();
+        {
+            auto pinned = tree.find(high);
+            REQUIRE(!tree.split(N / 2, greater), "case 10");
+            REQUIRE(tree.size() == s.size() && greater.empty(), "case 11");
+        }
+        auto pinned = tree.find(low);
+        tree.erase(*std::next(s.begin()));
+        s.erase(std::next(s.begin()));
+        REQUIRE(tree.split(N / 2, greater), "case 12");
+        REQUIRE((*pinned).get() == low && (*++pinned).get() == *s.upper_bound(low), "case 13");
+        REQUIRE(is_well_formed(tree) && is_well_formed(greater), "case 14");
+
+        // overlapping ranges don't join
+        greater.insert(low + 1);
+        REQUIRE(!tree.join(greater), "case 15");
+        REQUIRE(!greater.join(tree) && !tree.join(tree), "case 16");
+    }
+
+    void merge() {
+        test_case = "merge";
+        consistent_tree<int> tree;
+        consistent_tree<int> other;
+        std::set<int> s;
+        std::vector<int> left_over;
+        for (int i = 0; i < 2000; i++) {
+            if (i % 2 == 0) {
+                tree.insert(i);
+                s.insert(i);
+            } else {
+                other.insert(i);
+                s.insert(i);
+            }
+            if (i % 10 == 0) {
+                other.insert(i);
+                left_over.push_back(i);
+            }
+        }
+
+        REQUIRE(tree.merge(other), "case 1");
+        REQUIRE(tree.to_vector() == std::vector<int>(s.begin(), s.end()), "case 2");
+        REQUIRE(other.to_vector() == left_over, "case 3");
+        REQUIRE(is_well_formed(tree) && is_well_formed(other), "case 4");
+
+        // disjoint ranges on either side are joined
+        consistent_tree<int> low;
+        consistent_tree<int> high;
+        for (int i = 0; i < 100; i++) {
+            low.insert(-1 - i);
+            high.insert(5000 + i);
+        }
+        REQUIRE(tree.merge(low) && tree.merge(high), "case 5");
+        REQUIRE(low.empty() && high.empty() && tree.size() == s.size() + 200, "case 6");
+        REQUIRE(tree.front() == -100 && tree.back() == 5099, "case 7");
+        REQUIRE(is_well_formed(tree) && is_well_formed(low), "case 8");
+
+        auto pinned = other.begin();
+        REQUIRE(!tree.merge(other) && other.size() == left_over.size(), "case 9");
+    }
+
+    void set_algebra() {
+        test_case = "set_algebra";
+        using namespace consistent_execution;
+        thread_pool pool(4);
+
+        // similar sizes, then a small set against a large one
+        for (int small_size: {30000, 50}) {
+            consistent_tree<int> a;
+            consistent_tree<int> b;
+            std::set<int> sa;
+            std::set<int> sb;
+            for (auto it: get_random_vector(30000)) {
+                a.insert(it);
+                sa.insert(it);
+            }
+            auto vb = get_random_vector(30000, 15000);
+            vb.resize(small_size);
+            for (auto it: vb) {
+                b.insert(it);
+                sb.insert(it);
+            }
+            // erased nodes, some still pinned, are not part of the sets
+            std::vector<typename consistent_tree<int>::iterator> pinned;
+            for (int i = 0; i < 30000; i += 7) {
+                pinned.push_back(a.find(i));
+                a.erase(i);
+                sa.erase(i);
+            }
+
+            std::vector<int> expected_union;
+            std::vector<int> expected_intersection;
+            std::vector<int> expected_difference;
+            std::vector<int> expected_reverse_difference;
+            std::set_union(sa.begin(), sa.end(), sb.begin(), sb.end(), std::back_inserter(expected_union));
+            std::set_intersection(sa.begin(), sa.end(), sb.begin(), sb.end(),
+                                  std::back_inserter(expected_intersection));
+            std::set_difference(sa.begin(), sa.end(), sb.begin(), sb.end(),
+                                std::back_inserter(expected_difference));
+            std::set_difference(sb.begin(), sb.end(), sa.begin(), sa.end(),
+                                std::back_inserter(expected_reverse_difference));
+
+            for (int parallel = 0; parallel < 2; parallel++) {
+                std::string suffix = parallel ? ", par" : ", seq";
+                consistent_tree<int> u;
+                consistent_tree<int> i;
+                consistent_tree<int> d;
+                consistent_tree<int> r;
+                if (parallel) {
+                    REQUIRE(a.set_union(par(pool), b, u) && a.set_intersection(par(pool), b, i) &&
+                            a.set_difference(par(pool), b, d) && b.set_difference(par(pool), a, r), "case 1" + suffix);
+                } else {
+                    REQUIRE(a.set_union(b, u) && a.set_intersection(b, i) && a.set_difference(b, d) &&
+                            b.set_difference(a, r), "case 1" + suffix);
+                }
+                REQUIRE(u.to_vector() == expected_union, "case 2" + suffix);
+                REQUIRE(i.to_vector() == expected_intersection, "case 3" + suffix);
+                REQUIRE(d.to_vector() == expected_difference, "case 4" + suffix);
+                REQUIRE(r.to_vector() == expected_reverse_difference, "case 5" + suffix);
+                REQUIRE(is_well_formed(u) && is_well_formed(i) && is_well_formed(d) && is_well_formed(r),
+                        "case 6" + suffix);
+                REQUIRE(u.size() == expected_union.size() && u.rank(*sa.rbegin()) < u.size(), "case 7" + suffix);
+            }
+            REQUIRE(a.to_vector() == std::vector<int>(sa.begin(), sa.end()), "case 8");
+        }
+
+        // out must be empty and can't be an input; a tree with itself is fine
+        consistent_tree<int> a;
+        consistent_tree<int> out;
+        a.insert(1);
+        out.insert(2);
+        REQUIRE(!a.set_union(a, out) && !a.set_union(out, out), "case 9");
+        consistent_tree<int> self;
+        REQUIRE(a.set_intersection(a, self) && self.to_vector() == std::vector<int>{1}, "case 10");
+    }
+
+    void batch_lookup() {
+        test_case = "batch_lookup";
+        consistent_tree<int> tree;
+        int N = 1e4;
+        for (auto it: get_random_vector(N)) {
+            tree.insert(it);
+        }
+        std::vector<typename consistent_tree<int>::iterator> pinned;
+        for (int i = 0; i < N; i += 5) {
+            if (i % 10 == 0) {
+                pinned.push_back(tree.find(i));
+            }
+            tree.erase(i);
+        }
+
+        // present, erased, erased but pinned and absent keys, more than one group
+        std::vector<int> keys = get_random_vector(N + 200, -100);
+        keys.push_back(3);
+        keys.push_back(3);
+        auto found = tree.find_batch(keys);
+        auto contained = tree.contains_batch(keys);
+        REQUIRE(found.size() == keys.size() && contained.size() == keys.size(), "case 1");
+        for (size_t i = 0; i < keys.size(); i++) {
+            bool expected = keys[i] >= 0 && keys[i] < N && keys[i] % 5 != 0;
+            REQUIRE(contained[i] == expected, "case 2");
+            REQUIRE((found[i] != tree.end()) == expected, "case 3");
+            if (expected) {
+                REQUIRE((*found[i]).get() == keys[i], "case 4");
+            }
+        }
+
+        consistent_tree<int> empty;
+        REQUIRE(empty.contains_batch({1, 2}) == std::vector<bool>{false, false}, "case 5");
+        REQUIRE(tree.find_batch({}).empty(), "case 6");
+    }
+
+    void read_only_queries() {
+        test_case = "read_only_queries";
+        consistent_tree<int> tree;
+        REQUIRE(!tree.contains(1) && tree.count(1) == 0, "case 1");
+        REQUIRE(!tree.try_get(1) && !tree.lower_bound_value(1), "case 2");
+
+        std::set<int> s;
+        for (auto it: get_random_vector(1e3)) {
+            tree.insert(2 * it);
+            s.insert(2 * it);
+        }
+        std::vector<typename consistent_tree<int>::iterator> pinned;
+        for (int i = 0; i < 2e3; i += 6) {
+            pinned.push_back(tree.find(i));
+            tree.erase(i);
+            s.erase(i);
+        }
+
+        size_t pinned_nodes = tree.metrics().pinned_nodes;
+        for (int i = -1; i <= 2e3; i++) {
+            bool expected = s.count(i) == 1;
+            REQUIRE(tree.contains(i) == expected && tree.count(i) == s.count(i), "case 3");
+            REQUIRE(tree.try_get(i) == (expected ? std::optional<int>(i) : std::nullopt), "case 4");
+            auto next = s.lower_bound(i);
+            REQUIRE(tree.lower_bound_value(i) == (next == s.end() ? std::nullopt : std::optional<int>(*next)),
+                    "case 5");
+        }
+        // nothing was pinned on the way
+        REQUIRE(tree.metrics().pinned_nodes == pinned_nodes, "case 6");
+    }
+
     void destructor() {
         test_case = "destructor";
         auto *receiver1 = new receiver();
@@ -595,6 +1477,24 @@ private:
 
         REQUIRE(receiver1->value == size + 1, "case 3");
 
+
+        // assignment frees the old nodes and starts counting anew
+        receiver1->value = 0;
+        auto *tree4 = new consistent_tree<int>(receiver1);
+        for (auto it: v) {
+            tree4->insert(it);
+        }
+        consistent_tree<int> small;
+        for (int i = 0; i < 10; i++) {
+            small.insert(i);
+        }
+        *tree4 = small;
+        REQUIRE(tree4->to_vector() == small.to_vector() && tree4->size() == 10, "case 4");
+        REQUIRE(is_well_formed(*tree4), "case 5");
+        delete tree4;
+
+        REQUIRE(receiver1->value == 10 + 1, "case 6");
+
         delete receiver1;
     }
 
@@ -627,6 +1527,33 @@ public:
         inc_iterator();
         dec_iterator();
 
+        order_statistics();
+        move_only();
+        value_access();
+
+        comparator();
+        transparent_comparator();
+        comparisons_per_find();
+
+        parallel_to_vector();
+        chunked_to_vector();
+        bulk_algorithms();
+
+        latency_histogram_buckets();
+        stats();
+        lock_profiling();
+        metrics();
+        read_guard();
+        erase_by_iterator();
+        front_back_cached();
+        threaded_links();
+        hinted_insert();
+        split_join();
+        merge();
+        set_algebra();
+        batch_lookup();
+        read_only_queries();
+
         destructor();
 
         std::cout << test_counter - fail_counter << " TEST PASSED\n";
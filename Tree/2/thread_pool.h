@@ -0,0 +1,211 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <deque>
+#include <vector>
+
+/*
+ * Work-stealing pool. Every worker has its own deque: tasks submitted by a
+ * worker go to the back of its deque and are taken from the back (newest
+ * first, while their data is still in cache), idle workers steal from the
+ * front of the others' deques. Tasks from other threads are spread round-robin.
+ *
+ * A thread that waits for a task's result should use wait(), which runs
+ * pending tasks meanwhile, so tasks may wait for tasks of the same pool.
+ */
+class thread_pool {
+private:
+    class alignas(64) worker_queue {
+    public:
+        std::mutex mutex_;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<worker_queue[]> queues;
+    size_t n_queues = 0;
+
+    std::atomic<size_t> n_queued{0};
+    std::atomic<size_t> next_queue{0};
+
+    // idle workers sleep here
+    std::mutex mutex_;
+    std::condition_variable cv;
+    bool stopped = false;
+
+    static inline thread_local thread_pool *current_pool = nullptr;
+    static inline thread_local size_t current_index = 0;
+
+    // the calling worker's queue, or n_queues for other threads
+    size_t own_index() const {
+        return current_pool == this ? current_index : n_queues;
+    }
+
+    bool pop(size_t index, std::function<void()> &task) {
+        std::unique_lock lock(queues[index].mutex_);
+        if (queues[index].tasks.empty()) {
+            return false;
+        }
+        task = std::move(queues[index].tasks.back());
+        queues[index].tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t index, std::function<void()> &task) {
+        std::unique_lock lock(queues[index].mutex_, std::try_to_lock);
+        if (!lock.owns_lock() || queues[index].tasks.empty()) {
+            return false;
+        }
+        task = std::move(queues[index].tasks.front());
+        queues[index].tasks.pop_front();
+        return true;
+    }
+
+    bool take(std::function<void()> &task) {
+        if (n_queued.load(std::memory_order_acquire) == 0) {
+            return false;
+        }
+
+        size_t own = own_index();
+        if (own != n_queues && pop(own, task)) {
+            n_queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        size_t start = own == n_queues ? 0 : own + 1;
+        for (size_t i = 0; i < n_queues; ++i) {
+            size_t victim = (start + i) % n_queues;
+            if (victim != own && steal(victim, task)) {
+                n_queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t index) {
+        current_pool = this;
+        current_index = index;
+
+        std::function<void()> task;
+        while (true) {
+            if (take(task)) {
+                task();
+                continue;
+            }
+
+            std::unique_lock lock(mutex_);
+            if (stopped && n_queued.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+            // a try_lock in steal() can miss a task, so don't sleep for long
+            cv.wait_for(lock, std::chrono::milliseconds(1), [this] {
+                return stopped || n_queued.load(std::memory_order_acquire) > 0;
+            });
+        }
+    }
+
+public:
+    explicit thread_pool(size_t n_threads = std::thread::hardware_concurrency()) {
+        if (n_threads == 0) {
+            n_threads = 1;
+        }
+        n_queues = n_threads;
+        queues.reset(new worker_queue[n_queues]);
+        for (size_t i = 0; i < n_threads; ++i) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    thread_pool(const thread_pool &) = delete;
+
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    // runs the queued tasks and joins the workers
+    ~thread_pool() {
+        {
+            std::unique_lock lock(mutex_);
+            stopped = true;
+        }
+        cv.notify_all();
+        for (auto &worker: workers) {
+            worker.join();
+        }
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    template<typename F>
+    std::future<std::invoke_result_t<F>> submit(F fn) {
+        // std::function needs a copyable callable
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(fn));
+        auto res = task->get_future();
+
+        size_t index = own_index();
+        if (index == n_queues) {
+            index = next_queue.fetch_add(1, std::memory_order_relaxed) % n_queues;
+        }
+        {
+            std::unique_lock lock(queues[index].mutex_);
+            queues[index].tasks.emplace_back([task] { (*task)(); });
+        }
+        n_queued.fetch_add(1, std::memory_order_release);
+        {
+            // pairs with the check in work(), so the notification isn't lost
+            std::unique_lock lock(mutex_);
+        }
+        cv.notify_one();
+        return res;
+    }
+
+    // runs one queued task on the calling thread, false if there was none
+    bool run_pending_task() {
+        std::function<void()> task;
+        if (!take(task)) {
+            return false;
+        }
+        task();
+        return true;
+    }
+
+    template<typename R>
+    R wait(std::future<R> &future) {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!run_pending_task()) {
+                std::this_thread::yield();
+            }
+        }
+        return future.get();
+    }
+};
+
+/*
+ * Execution policies in the spirit of std::execution: algorithms of the
+ * consistent containers take seq or par(pool) as the first argument.
+ */
+namespace consistent_execution {
+    class sequenced_policy {
+    };
+
+    class parallel_policy {
+    public:
+        thread_pool &pool;
+
+        explicit parallel_policy(thread_pool &pool_) : pool(pool_) {}
+    };
+
+    inline constexpr sequenced_policy seq{};
+
+    inline parallel_policy par(thread_pool &pool) {
+        return parallel_policy(pool);
+    }
+}